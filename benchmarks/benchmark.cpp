@@ -0,0 +1,404 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+// Throughput benchmarks on synthetic corpora, which are generated from a fixed seed and are therefore identical in every run.
+// Usage: util_unicode_benchmarks [--filter <text>] [--size <bytes>] [--min-time <seconds>] [--json <file>]
+//                                [--baseline <file>] [--threshold <percent>]
+// With --baseline, the results are compared against a JSON file written by a previous run with --json, and the
+// exit code is 1 if any benchmark is slower than the baseline by more than the threshold (default 10%).
+
+import pragma.string.unicode;
+
+using namespace pragma::string;
+
+// Allocations through the global operator new. Allocations made by ICU itself (uprv_malloc) are not included, and
+// on Windows neither are allocations made inside of the util_unicode DLL.
+static std::atomic<size_t> g_allocationCount = 0;
+
+void *operator new(size_t size)
+{
+	g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+	if(auto *p = std::malloc(size > 0 ? size : 1))
+		return p;
+	throw std::bad_alloc {};
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+
+template<typename T>
+static void do_not_optimize(const T &value)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	static volatile const void *sink;
+	sink = &value;
+#else
+	asm volatile("" : : "g"(&value) : "memory");
+#endif
+}
+
+////////////////////
+
+// std::uniform_int_distribution is implementation-defined, so the corpora only use the raw output of the engine
+class CorpusGenerator {
+  public:
+	CorpusGenerator(uint32_t seed) : m_rng {seed} {}
+	uint32_t Next(uint32_t count) { return static_cast<uint32_t>(m_rng() % count); }
+	// Appends a code point from [first, last]
+	void AppendRange(std::string &str, Char32 first, Char32 last) { AppendCodePoint(str, first + static_cast<Char32>(Next(static_cast<uint32_t>(last - first + 1)))); }
+	void AppendWord(std::string &str)
+	{
+		auto len = 2 + Next(8);
+		for(uint32_t i = 0; i < len; ++i)
+			str += static_cast<char>('a' + Next(26));
+	}
+	static void AppendCodePoint(std::string &str, Char32 c)
+	{
+		if(c < 0x80)
+			str += static_cast<char>(c);
+		else if(c < 0x800) {
+			str += static_cast<char>(0xC0 | (c >> 6));
+			str += static_cast<char>(0x80 | (c & 0x3F));
+		}
+		else if(c < 0x10000) {
+			str += static_cast<char>(0xE0 | (c >> 12));
+			str += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			str += static_cast<char>(0x80 | (c & 0x3F));
+		}
+		else {
+			str += static_cast<char>(0xF0 | (c >> 18));
+			str += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+			str += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+			str += static_cast<char>(0x80 | (c & 0x3F));
+		}
+	}
+  private:
+	std::mt19937 m_rng;
+};
+
+// Words separated by spaces and some punctuation
+static void append_separator(CorpusGenerator &gen, std::string &str)
+{
+	auto r = gen.Next(20);
+	if(r == 0)
+		str += ".\n";
+	else if(r == 1)
+		str += ", ";
+	else
+		str += ' ';
+}
+
+static std::string generate_ascii(CorpusGenerator &gen, size_t size)
+{
+	std::string str;
+	while(str.size() < size) {
+		gen.AppendWord(str);
+		append_separator(gen, str);
+	}
+	return str;
+}
+// ASCII words with Latin-1 and Latin Extended-A letters (about a fifth of all letters)
+static std::string generate_latin(CorpusGenerator &gen, size_t size)
+{
+	std::string str;
+	while(str.size() < size) {
+		auto len = 2 + gen.Next(8);
+		for(uint32_t i = 0; i < len; ++i) {
+			if(gen.Next(5) == 0)
+				gen.AppendRange(str, 0xC0, 0x17F);
+			else
+				str += static_cast<char>('a' + gen.Next(26));
+		}
+		append_separator(gen, str);
+	}
+	return str;
+}
+// Hiragana, katakana and kanji with Japanese punctuation and some ASCII
+static std::string generate_japanese(CorpusGenerator &gen, size_t size)
+{
+	std::string str;
+	while(str.size() < size) {
+		auto r = gen.Next(10);
+		if(r < 4)
+			gen.AppendRange(str, 0x3041, 0x3093);
+		else if(r < 6)
+			gen.AppendRange(str, 0x30A1, 0x30F3);
+		else if(r < 9)
+			gen.AppendRange(str, 0x4E00, 0x4FFF);
+		else if(gen.Next(2) == 0)
+			CorpusGenerator::AppendCodePoint(str, 0x3002);
+		else
+			gen.AppendWord(str);
+	}
+	return str;
+}
+// ASCII words with emoji from the supplementary planes
+static std::string generate_emoji(CorpusGenerator &gen, size_t size)
+{
+	std::string str;
+	while(str.size() < size) {
+		if(gen.Next(3) == 0)
+			gen.AppendRange(str, 0x1F300, 0x1F64F);
+		else
+			gen.AppendWord(str);
+		append_separator(gen, str);
+	}
+	return str;
+}
+
+struct Corpus {
+	std::string name;
+	Utf8String text;
+};
+
+////////////////////
+
+struct BenchmarkResult {
+	std::string name;
+	std::string corpus;
+	size_t iterations = 0;
+	double seconds = 0.0;
+	double bytesPerSecond = 0.0;
+	double codePointsPerSecond = 0.0;
+	double allocationsPerOp = 0.0;
+};
+
+struct BenchmarkSettings {
+	std::string filter;
+	double minTime = 0.5;
+};
+
+class BenchmarkRunner {
+  public:
+	BenchmarkRunner(const BenchmarkSettings &settings) : m_settings {settings} {}
+	// bytes and codePoints are the amount of input processed by a single invocation of op
+	template<typename TOp>
+	void Run(const std::string &name, const std::string &corpus, size_t bytes, size_t codePoints, const TOp &op)
+	{
+		if(!m_settings.filter.empty() && (name + '/' + corpus).find(m_settings.filter) == std::string::npos)
+			return;
+		op(); // Warm-up
+		size_t iterations = 0;
+		auto allocations = g_allocationCount.load(std::memory_order_relaxed);
+		auto t0 = std::chrono::steady_clock::now();
+		std::chrono::duration<double> elapsed {};
+		do {
+			op();
+			++iterations;
+			elapsed = std::chrono::steady_clock::now() - t0;
+		} while(elapsed.count() < m_settings.minTime);
+		allocations = g_allocationCount.load(std::memory_order_relaxed) - allocations;
+
+		BenchmarkResult result {name, corpus, iterations, elapsed.count()};
+		result.bytesPerSecond = static_cast<double>(bytes) * iterations / result.seconds;
+		result.codePointsPerSecond = static_cast<double>(codePoints) * iterations / result.seconds;
+		result.allocationsPerOp = static_cast<double>(allocations) / iterations;
+		std::printf("%-28s %-10s %12.1f MB/s %12.1f Mcp/s %10.2f allocs/op\n", name.c_str(), corpus.c_str(), result.bytesPerSecond / 1e6, result.codePointsPerSecond / 1e6, result.allocationsPerOp);
+		m_results.push_back(std::move(result));
+	}
+	const std::vector<BenchmarkResult> &GetResults() const { return m_results; }
+  private:
+	BenchmarkSettings m_settings;
+	std::vector<BenchmarkResult> m_results;
+};
+
+static void run_string_benchmarks(BenchmarkRunner &runner, const Corpus &corpus)
+{
+	auto &text = corpus.text;
+	auto bytes = text.view().size();
+	auto codePoints = text.length();
+	std::string utf8 = text.cpp_str();
+
+	runner.Run("construct", corpus.name, bytes, codePoints, [&]() {
+		Utf8String str {utf8};
+		do_not_optimize(str);
+	});
+	runner.Run("cpp_str", corpus.name, bytes, codePoints, [&]() {
+		auto str = text.cpp_str();
+		do_not_optimize(str);
+	});
+	// The needle is taken from the end of the text, so that the entire text has to be searched
+	auto needle = text.substr(codePoints - std::min<size_t>(codePoints, 12));
+	runner.Run("find", corpus.name, bytes, codePoints, [&]() {
+		auto pos = text.find(needle);
+		do_not_optimize(pos);
+	});
+	runner.Run("iterate", corpus.name, bytes, codePoints, [&]() {
+		// Unsigned, since the sum of a large corpus overflows
+		uint64_t sum = 0;
+		for(auto c : text)
+			sum += static_cast<uint32_t>(c);
+		do_not_optimize(sum);
+	});
+	runner.Run("substr", corpus.name, bytes, codePoints, [&]() {
+		auto str = text.substr(codePoints / 4, codePoints / 2);
+		do_not_optimize(str);
+	});
+	// Includes copying the text, since toUpper modifies the string in place
+	runner.Run("toUpper", corpus.name, bytes, codePoints, [&]() {
+		auto str = text;
+		str.toUpper();
+		do_not_optimize(str);
+	});
+}
+
+static void run_shift_jis_benchmarks(BenchmarkRunner &runner, const Corpus &japanese)
+{
+	auto sjis = unicode::utf8_to_shift_jis(japanese.text.view());
+	auto codePoints = Utf8String {unicode::shift_jis_to_utf8(sjis)}.length();
+	runner.Run("shift_jis_to_utf8", "shift_jis", sjis.size(), codePoints, [&]() {
+		auto str = unicode::shift_jis_to_utf8(sjis);
+		do_not_optimize(str);
+	});
+	runner.Run("shift_jis_to_utf8_parallel", "shift_jis", sjis.size(), codePoints, [&]() {
+		auto str = unicode::shift_jis_to_utf8_parallel(sjis);
+		do_not_optimize(str);
+	});
+	runner.Run("utf8_to_shift_jis", "japanese", japanese.text.view().size(), japanese.text.length(), [&]() {
+		auto str = unicode::utf8_to_shift_jis(japanese.text.view());
+		do_not_optimize(str);
+	});
+}
+
+////////////////////
+
+static std::string escape_json(const std::string &str)
+{
+	std::string result;
+	for(auto c : str) {
+		if(c == '"' || c == '\\')
+			result += '\\';
+		result += c;
+	}
+	return result;
+}
+
+static bool write_json(const std::string &path, const std::vector<BenchmarkResult> &results)
+{
+	auto *f = std::fopen(path.c_str(), "w");
+	if(!f)
+		return false;
+	std::fprintf(f, "{\n\t\"results\": [\n");
+	for(size_t i = 0; i < results.size(); ++i) {
+		auto &r = results[i];
+		std::fprintf(f, "\t\t{\"name\": \"%s\", \"corpus\": \"%s\", \"iterations\": %zu, \"seconds\": %.6f, \"bytes_per_second\": %.1f, \"code_points_per_second\": %.1f, \"allocations_per_op\": %.3f}%s\n", escape_json(r.name).c_str(),
+		  escape_json(r.corpus).c_str(), r.iterations, r.seconds, r.bytesPerSecond, r.codePointsPerSecond, r.allocationsPerOp, (i + 1 < results.size()) ? "," : "");
+	}
+	std::fprintf(f, "\t]\n}\n");
+	return std::fclose(f) == 0;
+}
+
+// Only understands the format written by write_json: One result object per line.
+static std::optional<std::unordered_map<std::string, BenchmarkResult>> read_json(const std::string &path)
+{
+	auto *f = std::fopen(path.c_str(), "r");
+	if(!f)
+		return {};
+	std::unordered_map<std::string, BenchmarkResult> results;
+	auto getValue = [](const std::string &line, const std::string &key) -> std::string {
+		auto pos = line.find("\"" + key + "\": ");
+		if(pos == std::string::npos)
+			return {};
+		pos += key.size() + 4;
+		if(line[pos] == '"') {
+			auto end = line.find('"', pos + 1);
+			return line.substr(pos + 1, end - pos - 1);
+		}
+		return line.substr(pos, line.find_first_of(",}", pos) - pos);
+	};
+	char buf[1024];
+	while(std::fgets(buf, sizeof(buf), f)) {
+		std::string line = buf;
+		auto name = getValue(line, "name");
+		if(name.empty())
+			continue;
+		BenchmarkResult result {name, getValue(line, "corpus")};
+		result.bytesPerSecond = std::strtod(getValue(line, "bytes_per_second").c_str(), nullptr);
+		result.allocationsPerOp = std::strtod(getValue(line, "allocations_per_op").c_str(), nullptr);
+		results[result.name + '/' + result.corpus] = result;
+	}
+	std::fclose(f);
+	return results;
+}
+
+// Returns false if any benchmark regressed by more than thresholdPercent
+static bool compare_with_baseline(const std::vector<BenchmarkResult> &results, const std::unordered_map<std::string, BenchmarkResult> &baseline, double thresholdPercent)
+{
+	std::printf("\nComparison with baseline (threshold: %.1f%%)\n", thresholdPercent);
+	auto success = true;
+	for(auto &r : results) {
+		auto key = r.name + '/' + r.corpus;
+		auto it = baseline.find(key);
+		if(it == baseline.end() || it->second.bytesPerSecond <= 0.0) {
+			std::printf("%-36s %10s\n", key.c_str(), "new");
+			continue;
+		}
+		auto change = (r.bytesPerSecond / it->second.bytesPerSecond - 1.0) * 100.0;
+		auto regressed = (change < -thresholdPercent);
+		std::printf("%-36s %+9.1f%% %10.2f -> %.2f allocs/op%s\n", key.c_str(), change, it->second.allocationsPerOp, r.allocationsPerOp, regressed ? "  REGRESSION" : "");
+		success = success && !regressed;
+	}
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	BenchmarkSettings settings {};
+	size_t corpusSize = 1024 * 1024;
+	std::string jsonPath, baselinePath;
+	double thresholdPercent = 10.0;
+	for(int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if(i + 1 >= argc) {
+			std::fprintf(stderr, "Missing value for argument '%s'\n", arg.c_str());
+			return 2;
+		}
+		std::string value = argv[++i];
+		if(arg == "--filter")
+			settings.filter = value;
+		else if(arg == "--size")
+			corpusSize = std::max<size_t>(std::strtoull(value.c_str(), nullptr, 10), 64);
+		else if(arg == "--min-time")
+			settings.minTime = std::strtod(value.c_str(), nullptr);
+		else if(arg == "--json")
+			jsonPath = value;
+		else if(arg == "--baseline")
+			baselinePath = value;
+		else if(arg == "--threshold")
+			thresholdPercent = std::strtod(value.c_str(), nullptr);
+		else {
+			std::fprintf(stderr, "Unknown argument '%s'\n", arg.c_str());
+			return 2;
+		}
+	}
+
+	// Every corpus has its own generator, so that changing one corpus doesn't affect the others
+	std::vector<Corpus> corpora;
+	CorpusGenerator genAscii {1}, genLatin {2}, genJapanese {3}, genEmoji {4};
+	corpora.push_back({"ascii", Utf8String {generate_ascii(genAscii, corpusSize)}});
+	corpora.push_back({"latin", Utf8String {generate_latin(genLatin, corpusSize)}});
+	corpora.push_back({"japanese", Utf8String {generate_japanese(genJapanese, corpusSize)}});
+	corpora.push_back({"emoji", Utf8String {generate_emoji(genEmoji, corpusSize)}});
+
+	BenchmarkRunner runner {settings};
+	for(auto &corpus : corpora)
+		run_string_benchmarks(runner, corpus);
+	run_shift_jis_benchmarks(runner, corpora[2]);
+
+	if(!jsonPath.empty() && !write_json(jsonPath, runner.GetResults())) {
+		std::fprintf(stderr, "Failed to write '%s'\n", jsonPath.c_str());
+		return 2;
+	}
+	if(!baselinePath.empty()) {
+		auto baseline = read_json(baselinePath);
+		if(!baseline) {
+			std::fprintf(stderr, "Failed to read '%s'\n", baselinePath.c_str());
+			return 2;
+		}
+		if(!compare_with_baseline(runner.GetResults(), *baseline, thresholdPercent))
+			return 1;
+	}
+	return 0;
+}
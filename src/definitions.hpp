@@ -21,7 +21,6 @@
 #endif
 
 namespace icu_78 {
-	class StringCharacterIterator;
 	class UnicodeString;
 };
 
@@ -0,0 +1,146 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "instrumentation.hpp"
+
+module pragma.string.unicode;
+
+import :batch;
+
+using namespace pragma::string;
+
+Utf8StringTable::Utf8StringTable() : m_offsets {0} {}
+Utf8StringTable::Utf8StringTable(Utf8StringTable &&other) noexcept : m_buffer {std::move(other.m_buffer)}, m_offsets {std::move(other.m_offsets)} { other.m_offsets = {0}; }
+Utf8StringTable::~Utf8StringTable() {}
+Utf8StringTable &Utf8StringTable::operator=(Utf8StringTable &&other) noexcept
+{
+	m_buffer = std::move(other.m_buffer);
+	m_offsets = std::move(other.m_offsets);
+	other.m_buffer.clear();
+	other.m_offsets = {0};
+	return *this;
+}
+Utf8StringView Utf8StringTable::operator[](size_t index) const
+{
+	// The buffer only contains well-formed UTF-8, so the view doesn't have to validate it
+	Utf8StringView view {};
+	view.m_data = m_buffer.data() + m_offsets[index];
+	view.m_size = m_offsets[index + 1] - m_offsets[index];
+	return view;
+}
+Utf8StringView Utf8StringTable::at(size_t index) const
+{
+	if(index >= size())
+		throw std::out_of_range {"String table index out of range"};
+	return (*this)[index];
+}
+
+////////////////////
+
+// Returns the size of the UTF-8 output for the input. needsSanitizing is set for ill-formed UTF-8 input, which is rare,
+// so its sanitized copy is simply created twice (once for its size and then again to write it).
+static size_t get_utf8_size(std::string_view input, SourceEncoding encoding, const detail::ShiftJisConversionTable &shiftJisTable, uint8_t &needsSanitizing)
+{
+	if(encoding == SourceEncoding::ShiftJis)
+		return detail::get_shift_jis_utf8_size(shiftJisTable, input);
+	if(detail::is_well_formed_utf8(input))
+		return input.size();
+	needsSanitizing = true;
+	return Utf8String {input.data(), input.size()}.view().size();
+}
+static void write_utf8(std::string_view input, SourceEncoding encoding, const detail::ShiftJisConversionTable &shiftJisTable, bool needsSanitizing, char *output, size_t outputSize)
+{
+	if(encoding == SourceEncoding::ShiftJis) {
+		detail::shift_jis_to_utf8(shiftJisTable, input, output, outputSize);
+		return;
+	}
+	if(!needsSanitizing) {
+		std::memcpy(output, input.data(), input.size());
+		return;
+	}
+	Utf8String sanitized {input.data(), input.size()};
+	std::memcpy(output, sanitized.view().data(), std::min(outputSize, sanitized.view().size()));
+}
+
+template<typename TString>
+static void transcode_batch(std::span<const TString> inputs, const BatchTranscodeOptions &options, std::vector<size_t> &offsets, std::string &buffer)
+{
+	auto getInput = [&](size_t i) { return std::string_view {inputs[i]}; };
+
+	// Inputs [chunks[i], chunks[i + 1]) are processed by task i. Inputs are grouped by their total size, so that small
+	// strings don't end up as individual tasks.
+	std::vector<size_t> chunks {0};
+	if(options.parallel && inputs.size() > 1) {
+		size_t totalSize = 0;
+		for(auto &input : inputs)
+			totalSize += std::string_view {input}.size();
+		auto maxChunks = static_cast<size_t>(options.parallel->GetThreadCount()) * 4;
+		auto chunkSize = std::max({totalSize / maxChunks, options.parallel->minChunkSize, size_t {1}});
+		size_t curSize = 0;
+		for(size_t i = 0; i < inputs.size(); ++i) {
+			curSize += getInput(i).size();
+			if(curSize >= chunkSize) {
+				chunks.push_back(i + 1);
+				curSize = 0;
+			}
+		}
+	}
+	if(chunks.back() != inputs.size())
+		chunks.push_back(inputs.size());
+	auto numChunks = chunks.size() - 1;
+	auto runChunks = [&](const std::function<void(size_t)> &task) {
+		if(options.parallel && numChunks > 1)
+			run_parallel(numChunks, task, *options.parallel);
+		else {
+			for(size_t i = 0; i < numChunks; ++i)
+				task(i);
+		}
+	};
+
+	// The output size of every string is determined first, so that all strings can be written directly into their final location.
+	// Both passes have to use the same conversion table, in case init_shift_jis is called concurrently.
+	auto &shiftJisTable = detail::get_shift_jis_conversion_table();
+	offsets.resize(inputs.size() + 1);
+	offsets[0] = 0;
+	// Not std::vector<bool>, since it's written to concurrently
+	std::vector<uint8_t> needsSanitizing(inputs.size(), false);
+	runChunks([&](size_t chunk) {
+		for(auto i = chunks[chunk]; i < chunks[chunk + 1]; ++i)
+			offsets[i + 1] = get_utf8_size(getInput(i), options.encoding, shiftJisTable, needsSanitizing[i]);
+	});
+	std::inclusive_scan(offsets.begin(), offsets.end(), offsets.begin());
+
+	std::exception_ptr exception;
+	buffer.resize_and_overwrite(offsets.back(), [&](char *buf, size_t) {
+		try {
+			runChunks([&](size_t chunk) {
+				for(auto i = chunks[chunk]; i < chunks[chunk + 1]; ++i)
+					write_utf8(getInput(i), options.encoding, shiftJisTable, needsSanitizing[i], buf + offsets[i], offsets[i + 1] - offsets[i]);
+			});
+		}
+		catch(...) {
+			exception = std::current_exception();
+			return size_t {0};
+		}
+		return offsets.back();
+	});
+	if(exception)
+		std::rethrow_exception(exception);
+	UUNIC_COUNT_STRING_ALLOCATION(buffer);
+	UUNIC_COUNT_ALLOCATION(offsets.capacity() * sizeof(size_t));
+}
+
+Utf8StringTable pragma::string::transcode_batch(std::span<const std::string_view> inputs, const BatchTranscodeOptions &options)
+{
+	Utf8StringTable table;
+	::transcode_batch(inputs, options, table.m_offsets, table.m_buffer);
+	return table;
+}
+Utf8StringTable pragma::string::transcode_batch(std::span<const std::string> inputs, const BatchTranscodeOptions &options)
+{
+	Utf8StringTable table;
+	::transcode_batch(inputs, options, table.m_offsets, table.m_buffer);
+	return table;
+}
@@ -0,0 +1,165 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "simd.hpp"
+#include "validate_utf8.hpp"
+
+module pragma.string.unicode;
+
+import :detection;
+import :shift_jis;
+
+using namespace pragma::string;
+
+Utf8ValidationResult pragma::string::validate_utf8_buffer(std::string_view data)
+{
+	auto offset = detail::find_invalid_utf8(data.data(), data.size());
+	if(offset == data.size())
+		return {};
+	return {false, offset};
+}
+
+////////////////////
+
+// The data is scanned in chunks of this size, so that each chunk is still cached when the next scanner reads it
+static constexpr size_t DETECTION_CHUNK_SIZE = 64 * 1024;
+
+struct ByteStatistics {
+	size_t nonAscii = 0;
+	// Zero bytes at even and odd offsets (relative to the end of the byte order mark)
+	size_t zeroEven = 0;
+	size_t zeroOdd = 0;
+};
+// size has to be even, except for the last chunk
+static void count_bytes(const uint8_t *data, size_t size, ByteStatistics &stats)
+{
+	size_t i = 0;
+#ifdef UUNIC_SIMD_X86
+	// The counts are accumulated per byte lane and summed up before the lanes can overflow
+	auto zero = _mm_setzero_si128();
+	auto evenLanes = _mm_set1_epi16(0x00FF);
+	while(i + sizeof(__m128i) <= size) {
+		auto nonAscii = zero;
+		auto zeros = zero;
+		for(size_t j = 0; j < 255 && i + sizeof(__m128i) <= size; ++j, i += sizeof(__m128i)) {
+			auto block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+			nonAscii = _mm_sub_epi8(nonAscii, _mm_cmplt_epi8(block, zero));
+			zeros = _mm_sub_epi8(zeros, _mm_cmpeq_epi8(block, zero));
+		}
+		auto sum = [](__m128i v) { return static_cast<size_t>(_mm_cvtsi128_si32(v) + _mm_extract_epi16(v, 4)); };
+		stats.nonAscii += sum(_mm_sad_epu8(nonAscii, zero));
+		stats.zeroEven += sum(_mm_sad_epu8(_mm_and_si128(zeros, evenLanes), zero));
+		stats.zeroOdd += sum(_mm_sad_epu8(_mm_srli_epi16(zeros, 8), zero));
+	}
+#endif
+	for(; i < size; ++i) {
+		if(data[i] >= 0x80)
+			++stats.nonAscii;
+		else if(data[i] == 0)
+			++((i % 2 == 0) ? stats.zeroEven : stats.zeroOdd);
+	}
+}
+
+// Each non-ASCII byte of data that is valid in both encodings makes it less likely that it is valid in
+// the other encoding only by coincidence
+static float get_confidence(size_t nonAscii) { return 1.f - std::pow(0.5f, static_cast<float>(std::min<size_t>(nonAscii, 64))); }
+
+EncodingDetectionResult pragma::string::detect_encoding(std::string_view data)
+{
+	auto *bytes = reinterpret_cast<const uint8_t *>(data.data());
+	if(data.starts_with("\xEF\xBB\xBF"))
+		return {TextEncoding::Utf8, 1.f, 3};
+	if(data.starts_with("\xFF\xFE"))
+		return {TextEncoding::Utf16Le, 1.f, 2};
+	if(data.starts_with("\xFE\xFF"))
+		return {TextEncoding::Utf16Be, 1.f, 2};
+
+	// Shift_JIS is only scanned for as long as it is still plausible, i.e. there are at most 1% errors
+	auto maxShiftJisErrors = data.size() / 100;
+	constexpr unicode::ShiftJisValidationOptions shiftJisOptions {.includeCrlf = true};
+	ByteStatistics stats {};
+	auto isUtf8 = true;
+	size_t utf8Pos = 0;
+	size_t shiftJisPos = 0;
+	size_t shiftJisErrors = 0;
+	for(size_t chunkStart = 0; chunkStart < data.size();) {
+		auto chunkEnd = std::min(data.size(), chunkStart + DETECTION_CHUNK_SIZE);
+		count_bytes(bytes + chunkStart, chunkEnd - chunkStart, stats);
+
+		if(isUtf8) {
+			// Chunks must not split code points, which would be reported as ill-formed
+			auto end = (chunkEnd < data.size()) ? detail::find_code_point_start(data.data(), chunkEnd) : chunkEnd;
+			isUtf8 = (detail::find_invalid_utf8(data.data() + utf8Pos, end - utf8Pos) == end - utf8Pos);
+			utf8Pos = end;
+		}
+
+		while(shiftJisErrors <= maxShiftJisErrors && shiftJisPos < chunkEnd) {
+			auto result = unicode::validate_shift_jis_buffer(data.substr(shiftJisPos, chunkEnd - shiftJisPos), shiftJisOptions);
+			if(result.valid) {
+				shiftJisPos = chunkEnd;
+				break;
+			}
+			auto errorPos = shiftJisPos + result.errorOffset;
+			if(errorPos + 1 == chunkEnd && chunkEnd < data.size()) {
+				// Possibly a double-byte character (or CR LF) that is split by the end of the chunk
+				shiftJisPos = errorPos;
+				break;
+			}
+			++shiftJisErrors;
+			shiftJisPos = errorPos + 1;
+		}
+		chunkStart = chunkEnd;
+	}
+
+	// UTF-16 without a byte order mark is only recognized by the zero bytes of ASCII and Latin-1 characters
+	auto numPairs = data.size() / 2;
+	if(stats.zeroOdd >= numPairs / 4 && stats.zeroOdd > 0 && stats.zeroEven * 8 <= stats.zeroOdd)
+		return {TextEncoding::Utf16Le, std::min(1.f, 2.f * stats.zeroOdd / numPairs)};
+	if(stats.zeroEven >= numPairs / 4 && stats.zeroEven > 0 && stats.zeroOdd * 8 <= stats.zeroEven)
+		return {TextEncoding::Utf16Be, std::min(1.f, 2.f * stats.zeroEven / numPairs)};
+
+	if(stats.nonAscii == 0)
+		return {TextEncoding::Utf8, 1.f};
+	if(isUtf8)
+		return {TextEncoding::Utf8, (shiftJisErrors == 0) ? get_confidence(stats.nonAscii) : 1.f};
+	if(shiftJisErrors == 0)
+		return {TextEncoding::ShiftJis, get_confidence(stats.nonAscii)};
+	if(shiftJisErrors * 100 <= stats.nonAscii)
+		return {TextEncoding::ShiftJis, 0.5f * (1.f - static_cast<float>(shiftJisErrors * 100) / stats.nonAscii)};
+	return {};
+}
+
+static Utf8String decode_utf16(std::string_view data, bool bigEndian)
+{
+	std::u16string utf16;
+	auto size = (data.size() + 1) / 2;
+	utf16.resize_and_overwrite(size, [&](char16_t *buf, size_t) {
+		auto *bytes = reinterpret_cast<const uint8_t *>(data.data());
+		for(size_t i = 0; i < data.size() / 2; ++i)
+			buf[i] = bigEndian ? static_cast<char16_t>((bytes[i * 2] << 8) | bytes[i * 2 + 1]) : static_cast<char16_t>(bytes[i * 2] | (bytes[i * 2 + 1] << 8));
+		// Truncated code unit
+		if(data.size() % 2 != 0)
+			buf[size - 1] = u'\uFFFD';
+		return size;
+	});
+	return Utf8String {utf16.data(), utf16.size()};
+}
+Utf8String pragma::string::decode_auto(std::string_view data, EncodingDetectionResult *outDetection, const ParallelOptions &parallelOptions)
+{
+	auto detection = detect_encoding(data);
+	if(outDetection)
+		*outDetection = detection;
+	data = data.substr(detection.bomSize);
+	switch(detection.encoding) {
+	case TextEncoding::Utf16Le:
+		return decode_utf16(data, false);
+	case TextEncoding::Utf16Be:
+		return decode_utf16(data, true);
+	case TextEncoding::ShiftJis:
+		return detail::Utf8StringAccess::AdoptWellFormed(unicode::shift_jis_to_utf8_parallel(data, parallelOptions));
+	default:
+		return Utf8String {data.data(), data.size()};
+	}
+}
@@ -0,0 +1,158 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "validate_utf8.hpp"
+#include "instrumentation.hpp"
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+module pragma.string.unicode;
+
+import :file;
+
+using namespace pragma::string;
+
+// Input is decoded and released in chunks of this size
+static constexpr size_t FILE_CHUNK_SIZE = 4 * 1024 * 1024;
+
+static size_t get_page_size()
+{
+#ifdef __linux__
+	static const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+	static const auto pageSize = [] {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return static_cast<size_t>(info.dwPageSize);
+	}();
+#endif
+	return pageSize;
+}
+
+detail::MappedFile::MappedFile(const std::string &filePath)
+{
+	// The file handles are closed once the file has been mapped, the mapping stays valid until it is unmapped
+#ifdef __linux__
+	auto fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd == -1)
+		throw std::runtime_error {"Failed to open file '" + filePath + "'!"};
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		close(fd);
+		throw std::runtime_error {"Failed to read file '" + filePath + "'!"};
+	}
+	m_size = static_cast<size_t>(st.st_size);
+	if(m_size > 0) {
+		auto *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error {"Failed to map file '" + filePath + "'!"};
+		}
+		// The file is read front to back, so the OS can read ahead aggressively
+		madvise(data, m_size, MADV_SEQUENTIAL);
+		m_data = static_cast<const char *>(data);
+	}
+	close(fd);
+#else
+	// The path is UTF-8, which a std::filesystem::path constructed from a std::string would interpret in the ANSI code page
+	std::filesystem::path path {std::u8string_view {reinterpret_cast<const char8_t *>(filePath.data()), filePath.size()}};
+	auto hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if(hFile == INVALID_HANDLE_VALUE)
+		throw std::runtime_error {"Failed to open file '" + filePath + "'!"};
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(hFile, &size)) {
+		CloseHandle(hFile);
+		throw std::runtime_error {"Failed to read file '" + filePath + "'!"};
+	}
+	m_size = static_cast<size_t>(size.QuadPart);
+	if(m_size > 0) {
+		auto hMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		auto *data = hMapping ? MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if(hMapping)
+			CloseHandle(hMapping);
+		if(!data) {
+			CloseHandle(hFile);
+			throw std::runtime_error {"Failed to map file '" + filePath + "'!"};
+		}
+		m_data = static_cast<const char *>(data);
+	}
+	CloseHandle(hFile);
+#endif
+}
+detail::MappedFile::~MappedFile()
+{
+	if(!m_data)
+		return;
+#ifdef __linux__
+	munmap(const_cast<char *>(m_data), m_size);
+#else
+	UnmapViewOfFile(m_data);
+#endif
+}
+void detail::MappedFile::ReleaseUntil(size_t offset)
+{
+	// The last page may only be partially used by the file
+	auto end = (offset >= m_size) ? m_size : offset / get_page_size() * get_page_size();
+	if(end <= m_releasedSize)
+		return;
+	auto *data = const_cast<char *>(m_data) + m_releasedSize;
+#ifdef __linux__
+	// Only drops the pages from memory, they're read from the file again if they're accessed after all
+	madvise(data, end - m_releasedSize, MADV_DONTNEED);
+#else
+	// Unlocking pages that aren't locked removes them from the working set
+	VirtualUnlock(data, end - m_releasedSize);
+#endif
+	m_releasedSize = end;
+}
+Utf8String detail::MappedFile::Decode(SourceEncoding encoding, const FileLoadOptions &options)
+{
+	auto onChunkDecoded = [this, &options](size_t offset) {
+		if(options.releaseDecodedPages)
+			ReleaseUntil(offset);
+	};
+	Utf8String str {};
+	if(encoding == SourceEncoding::ShiftJis) {
+		str.m_utf8 = shift_jis_to_utf8_chunked(GetData(), FILE_CHUNK_SIZE, onChunkDecoded);
+		return str;
+	}
+
+	size_t start = 0;
+	if(options.skipBom && GetData().starts_with("\xEF\xBB\xBF"))
+		start = 3;
+	// Well-formed UTF-8 has the same size as the input, so it can be validated while it is copied
+	auto input = GetData().substr(start);
+	auto wellFormed = true;
+	str.m_utf8.resize_and_overwrite(input.size(), [&](char *buf, size_t) {
+		auto size = input.size();
+		for(size_t offset = 0; offset < size;) {
+			auto end = (size - offset > FILE_CHUNK_SIZE) ? find_code_point_start(input.data(), offset + FILE_CHUNK_SIZE) : size;
+			if(find_invalid_utf8(input.data() + offset, end - offset) != end - offset) {
+				wellFormed = false;
+				return size_t {0};
+			}
+			std::memcpy(buf + offset, input.data() + offset, end - offset);
+			onChunkDecoded(start + end);
+			offset = end;
+		}
+		return size;
+	});
+	// Ill-formed input is rare, so it is simply sanitized from the start again
+	if(!wellFormed)
+		return Utf8String {input.data(), input.size()};
+	UUNIC_COUNT_STRING_ALLOCATION(str.m_utf8);
+	return str;
+}
+
+Utf8String pragma::string::load_utf8_file(const std::string &filePath, const FileLoadOptions &options) { return detail::MappedFile {filePath}.Decode(SourceEncoding::Utf8, options); }
+Utf8String pragma::string::load_shift_jis_file(const std::string &filePath, const FileLoadOptions &options) { return detail::MappedFile {filePath}.Decode(SourceEncoding::ShiftJis, options); }
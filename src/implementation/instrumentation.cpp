@@ -0,0 +1,69 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "instrumentation.hpp"
+
+module pragma.string.unicode;
+
+import :instrumentation;
+
+using namespace pragma::string;
+
+InstrumentationCounters InstrumentationCounters::operator-(const InstrumentationCounters &other) const
+{
+	return {allocationCount - other.allocationCount, allocatedBytes - other.allocatedBytes, utf8ToUtf16Count - other.utf8ToUtf16Count, utf16ToUtf8Count - other.utf16ToUtf8Count, transcodedBytes - other.transcodedBytes,
+	  transcodeTimeNs - other.transcodeTimeNs, shiftJisDecodedBytes - other.shiftJisDecodedBytes, shiftJisDecodeTimeNs - other.shiftJisDecodeTimeNs};
+}
+InstrumentationCounters &InstrumentationCounters::operator+=(const InstrumentationCounters &other)
+{
+	allocationCount += other.allocationCount;
+	allocatedBytes += other.allocatedBytes;
+	utf8ToUtf16Count += other.utf8ToUtf16Count;
+	utf16ToUtf8Count += other.utf16ToUtf8Count;
+	transcodedBytes += other.transcodedBytes;
+	transcodeTimeNs += other.transcodeTimeNs;
+	shiftJisDecodedBytes += other.shiftJisDecodedBytes;
+	shiftJisDecodeTimeNs += other.shiftJisDecodeTimeNs;
+	return *this;
+}
+
+#ifdef UUNIC_ENABLE_INSTRUMENTATION
+template<typename TValues>
+static InstrumentationCounters to_counters(const TValues &values)
+{
+	auto get = [&](detail::Counter counter) -> uint64_t { return values[static_cast<size_t>(counter)]; };
+	return {get(detail::Counter::AllocationCount), get(detail::Counter::AllocatedBytes), get(detail::Counter::Utf8ToUtf16Count), get(detail::Counter::Utf16ToUtf8Count), get(detail::Counter::TranscodedBytes),
+	  get(detail::Counter::TranscodeTime), get(detail::Counter::ShiftJisDecodedBytes), get(detail::Counter::ShiftJisDecodeTime)};
+}
+static detail::CounterValues load_values(const detail::ThreadCounters &counters)
+{
+	detail::CounterValues values;
+	for(size_t i = 0; i < values.size(); ++i)
+		values[i] = counters.values[i].load(std::memory_order_relaxed);
+	return values;
+}
+
+bool pragma::string::is_instrumentation_enabled() { return true; }
+InstrumentationCounters pragma::string::get_thread_counters() { return to_counters(load_values(detail::get_thread_counters())); }
+void pragma::string::reset_thread_counters()
+{
+	for(auto &v : detail::get_thread_counters().values)
+		v.store(0, std::memory_order_relaxed);
+}
+InstrumentationCounters pragma::string::get_total_counters()
+{
+	auto &registry = detail::get_counter_registry();
+	std::scoped_lock lock {registry.mutex};
+	auto counters = to_counters(registry.retired);
+	for(auto *threadCounters : registry.threads)
+		counters += to_counters(load_values(*threadCounters));
+	return counters;
+}
+#else
+bool pragma::string::is_instrumentation_enabled() { return false; }
+InstrumentationCounters pragma::string::get_thread_counters() { return {}; }
+void pragma::string::reset_thread_counters() {}
+InstrumentationCounters pragma::string::get_total_counters() { return {}; }
+#endif
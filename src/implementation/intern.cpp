@@ -0,0 +1,121 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "instrumentation.hpp"
+#include "validate_utf8.hpp"
+
+module pragma.string.unicode;
+
+import :intern;
+
+using namespace pragma::string;
+
+Utf8StringView InternedString::to_view() const
+{
+	// Interned strings are always well-formed, so the view doesn't have to validate them
+	Utf8StringView view {};
+	if(m_entry) {
+		view.m_data = m_entry->data;
+		view.m_size = m_entry->size;
+	}
+	return view;
+}
+
+////////////////////
+
+StringPool::StringPool(size_t blockSize) : m_blockSize {std::max(blockSize, sizeof(detail::InternedEntry))} {}
+StringPool::~StringPool() {}
+const detail::InternedEntry *StringPool::Allocate(std::string_view utf8, size_t hash)
+{
+	constexpr auto alignment = alignof(detail::InternedEntry);
+	auto requiredSize = sizeof(detail::InternedEntry) + utf8.size();
+	char *p;
+	if(requiredSize > m_blockSize) {
+		// Oversized strings get a dedicated block, the current block stays the last one so it can still be filled up
+		Block block {std::make_unique<char[]>(requiredSize), requiredSize, requiredSize};
+		UUNIC_COUNT_ALLOCATION(requiredSize);
+		p = block.data.get();
+		m_blocks.insert(m_blocks.empty() ? m_blocks.end() : m_blocks.end() - 1, std::move(block));
+	}
+	else {
+		auto offset = m_blocks.empty() ? m_blockSize : (m_blocks.back().used + alignment - 1) & ~(alignment - 1);
+		if(offset + requiredSize > m_blockSize) {
+			m_blocks.push_back({std::make_unique<char[]>(m_blockSize), m_blockSize, 0});
+			UUNIC_COUNT_ALLOCATION(m_blockSize);
+			offset = 0;
+		}
+		auto &block = m_blocks.back();
+		p = block.data.get() + offset;
+		block.used = offset + requiredSize;
+	}
+	auto *data = p + sizeof(detail::InternedEntry);
+	std::memcpy(data, utf8.data(), utf8.size());
+	return new(p) detail::InternedEntry {data, utf8.size(), hash};
+}
+InternedString StringPool::InternValid(std::string_view utf8, size_t hash)
+{
+	detail::HashedKey key {utf8, hash};
+	{
+		std::shared_lock lock {m_mutex};
+		auto it = m_entries.find(key);
+		if(it != m_entries.end()) {
+			m_hitCount.fetch_add(1, std::memory_order_relaxed);
+			return {it->second};
+		}
+	}
+	std::unique_lock lock {m_mutex};
+	// Another thread may have interned the string in the meantime
+	auto it = m_entries.find(key);
+	if(it != m_entries.end()) {
+		m_hitCount.fetch_add(1, std::memory_order_relaxed);
+		return {it->second};
+	}
+	auto *entry = Allocate(utf8, hash);
+	m_entries.emplace(detail::HashedKey {{entry->data, entry->size}, hash}, entry);
+	m_stringBytes += entry->size;
+	return {entry};
+}
+InternedString StringPool::Intern(std::string_view utf8)
+{
+	m_internCount.fetch_add(1, std::memory_order_relaxed);
+	// Ill-formed input is rare, so a sanitized copy is only created if there actually is an ill-formed sequence
+	if(detail::find_invalid_utf8(utf8.data(), utf8.size()) != utf8.size()) {
+		Utf8String sanitized {utf8.data(), utf8.size()};
+		return InternValid(sanitized.view(), utf8_hash(sanitized.view()));
+	}
+	return InternValid(utf8, utf8_hash(utf8));
+}
+InternedString StringPool::Intern(const BaseUtf8String &str)
+{
+	m_internCount.fetch_add(1, std::memory_order_relaxed);
+	return InternValid(str.view(), utf8_hash(str.view()));
+}
+InternedString StringPool::Find(std::string_view utf8) const
+{
+	detail::HashedKey key {utf8, utf8_hash(utf8)};
+	std::shared_lock lock {m_mutex};
+	auto it = m_entries.find(key);
+	return (it != m_entries.end()) ? InternedString {it->second} : InternedString {};
+}
+StringPool::Statistics StringPool::GetStatistics() const
+{
+	std::shared_lock lock {m_mutex};
+	Statistics stats {};
+	stats.stringCount = m_entries.size();
+	stats.stringBytes = m_stringBytes;
+	for(auto &block : m_blocks)
+		stats.arenaBytes += block.size;
+	stats.arenaBlockCount = m_blocks.size();
+	stats.internCount = m_internCount.load(std::memory_order_relaxed);
+	stats.hitCount = m_hitCount.load(std::memory_order_relaxed);
+	return stats;
+}
+void StringPool::Clear()
+{
+	std::unique_lock lock {m_mutex};
+	m_entries.clear();
+	m_blocks.clear();
+	m_stringBytes = 0;
+}
@@ -0,0 +1,124 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "simd.hpp"
+#include "instrumentation.hpp"
+#include <unicode/normalizer2.h>
+#include <unicode/bytestream.h>
+
+module pragma.string.unicode;
+
+import :normalization;
+
+using namespace pragma::string;
+
+static const icu::Normalizer2 &get_normalizer(NormalizationForm form)
+{
+	// The instances are owned by ICU and can be shared between threads
+	static const auto normalizers = []() {
+		std::array<const icu::Normalizer2 *, static_cast<size_t>(NormalizationForm::Count)> normalizers {};
+		UErrorCode err = U_ZERO_ERROR;
+		normalizers[static_cast<size_t>(NormalizationForm::Nfc)] = icu::Normalizer2::getNFCInstance(err);
+		normalizers[static_cast<size_t>(NormalizationForm::Nfd)] = icu::Normalizer2::getNFDInstance(err);
+		normalizers[static_cast<size_t>(NormalizationForm::Nfkc)] = icu::Normalizer2::getNFKCInstance(err);
+		normalizers[static_cast<size_t>(NormalizationForm::NfkcCasefold)] = icu::Normalizer2::getNFKCCasefoldInstance(err);
+		if(U_FAILURE(err))
+			throw std::runtime_error {std::string {"Failed to load normalization data: "} + u_errorName(err)};
+		return normalizers;
+	}();
+	return *normalizers[static_cast<size_t>(form)];
+}
+
+// Returns the size of the prefix of utf8 that is normalized in the given form and that can't interact with the remaining
+// characters. ASCII characters are normalized in all forms (except upper case letters for NFKC_Casefold), but the last one
+// may compose with a following combining mark, so it is excluded unless the whole string is ASCII.
+static size_t get_normalized_prefix_size(std::string_view utf8, NormalizationForm form)
+{
+	auto caseFold = (form == NormalizationForm::NfkcCasefold);
+	size_t offset = 0;
+#ifdef UUNIC_SIMD_X86
+	auto bias = _mm_set1_epi8(static_cast<char>(0x80 - 'A'));
+	auto limit = _mm_set1_epi8(static_cast<char>(0x80 + 26));
+	for(; offset + sizeof(__m128i) <= utf8.size(); offset += sizeof(__m128i)) {
+		auto block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(utf8.data() + offset));
+		auto mask = _mm_movemask_epi8(block);
+		if(caseFold)
+			mask |= _mm_movemask_epi8(_mm_cmplt_epi8(_mm_add_epi8(block, bias), limit));
+		if(mask != 0)
+			break;
+	}
+#endif
+	for(; offset < utf8.size(); ++offset) {
+		auto c = static_cast<uint8_t>(utf8[offset]);
+		if(c >= 0x80 || (caseFold && c >= 'A' && c <= 'Z'))
+			break;
+	}
+	if(offset == utf8.size())
+		return offset;
+	return (offset > 0) ? offset - 1 : 0;
+}
+
+static bool is_normalized(std::string_view utf8, NormalizationForm form)
+{
+	auto prefix = get_normalized_prefix_size(utf8, form);
+	if(prefix == utf8.size())
+		return true;
+	UErrorCode err = U_ZERO_ERROR;
+	auto rest = utf8.substr(prefix);
+	auto normalized = get_normalizer(form).isNormalizedUTF8(icu::StringPiece {rest.data(), static_cast<int32_t>(rest.size())}, err);
+	return U_SUCCESS(err) && normalized;
+}
+// Only the part after the normalized prefix is passed to ICU, which in turn only rewrites the segments that aren't normalized
+static std::string normalize(std::string_view utf8, NormalizationForm form)
+{
+	auto prefix = get_normalized_prefix_size(utf8, form);
+	std::string result;
+	result.reserve(utf8.size());
+	result.append(utf8.data(), prefix);
+	auto rest = utf8.substr(prefix);
+	icu::StringByteSink<std::string> sink {&result, static_cast<int32_t>(rest.size())};
+	UErrorCode err = U_ZERO_ERROR;
+	get_normalizer(form).normalizeUTF8(0, icu::StringPiece {rest.data(), static_cast<int32_t>(rest.size())}, sink, nullptr, err);
+	if(U_FAILURE(err))
+		throw std::runtime_error {std::string {"Failed to normalize string: "} + u_errorName(err)};
+	UUNIC_COUNT_STRING_ALLOCATION(result);
+	return result;
+}
+
+bool pragma::string::is_normalized(const BaseUtf8String &str, NormalizationForm form) { return ::is_normalized(str.view(), form); }
+Utf8String pragma::string::normalize(const BaseUtf8String &str, NormalizationForm form)
+{
+	if(::is_normalized(str.view(), form))
+		return Utf8String {str.view().data(), str.view().size()};
+	return Utf8String {::normalize(str.view(), form)};
+}
+bool pragma::string::normalize_in_place(Utf8String &str, NormalizationForm form)
+{
+	if(::is_normalized(str.view(), form))
+		return false;
+	str = ::normalize(str.view(), form);
+	return true;
+}
+bool pragma::string::normalized_equals(const BaseUtf8String &a, const BaseUtf8String &b, NormalizationForm form)
+{
+	auto utf8A = a.view();
+	auto utf8B = b.view();
+	if(utf8A == utf8B)
+		return true;
+	auto isNormalizedA = ::is_normalized(utf8A, form);
+	auto isNormalizedB = ::is_normalized(utf8B, form);
+	if(isNormalizedA && isNormalizedB)
+		return false;
+	std::string normalizedA, normalizedB;
+	if(!isNormalizedA) {
+		normalizedA = ::normalize(utf8A, form);
+		utf8A = normalizedA;
+	}
+	if(!isNormalizedB) {
+		normalizedB = ::normalize(utf8B, form);
+		utf8B = normalizedB;
+	}
+	return utf8A == utf8B;
+}
@@ -0,0 +1,56 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+module pragma.string.unicode;
+
+import :parallel;
+
+uint32_t pragma::string::ParallelOptions::GetThreadCount() const
+{
+	if(threadCount > 0)
+		return threadCount;
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void pragma::string::run_parallel(size_t count, const std::function<void(size_t)> &task, const ParallelOptions &options)
+{
+	if(count == 0)
+		return;
+	if(options.executor) {
+		options.executor(count, task);
+		return;
+	}
+	auto numThreads = std::min<size_t>(options.GetThreadCount(), count);
+	if(numThreads <= 1) {
+		for(size_t i = 0; i < count; ++i)
+			task(i);
+		return;
+	}
+
+	std::atomic<size_t> nextTask = 0;
+	std::exception_ptr exception;
+	std::mutex exceptionMutex;
+	auto worker = [&]() {
+		for(auto i = nextTask++; i < count; i = nextTask++) {
+			try {
+				task(i);
+			}
+			catch(...) {
+				std::scoped_lock lock {exceptionMutex};
+				if(!exception)
+					exception = std::current_exception();
+			}
+		}
+	};
+	std::vector<std::thread> threads;
+	threads.reserve(numThreads - 1);
+	for(size_t i = 1; i < numThreads; ++i)
+		threads.emplace_back(worker);
+	worker();
+	for(auto &t : threads)
+		t.join();
+	if(exception)
+		std::rethrow_exception(exception);
+}
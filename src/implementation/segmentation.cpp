@@ -0,0 +1,227 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include <unicode/brkiter.h>
+#include <unicode/utext.h>
+#include <unicode/locid.h>
+
+module pragma.string.unicode;
+
+import :utf8;
+
+using namespace pragma::string;
+
+// Creating a break iterator is expensive, so every thread keeps one instance per type and only resets its text
+static icu::BreakIterator &get_break_iterator(BreakType type)
+{
+	thread_local std::array<std::unique_ptr<icu::BreakIterator>, static_cast<size_t>(BreakType::Count)> breakIterators;
+	auto &it = breakIterators[static_cast<size_t>(type)];
+	if(!it) {
+		UErrorCode err = U_ZERO_ERROR;
+		auto &locale = icu::Locale::getDefault();
+		switch(type) {
+		case BreakType::Grapheme:
+			it.reset(icu::BreakIterator::createCharacterInstance(locale, err));
+			break;
+		case BreakType::Word:
+			it.reset(icu::BreakIterator::createWordInstance(locale, err));
+			break;
+		default:
+			it.reset(icu::BreakIterator::createLineInstance(locale, err));
+			break;
+		}
+		if(U_FAILURE(err) || !it) {
+			it = nullptr;
+			throw std::runtime_error {std::string {"Failed to create break iterator: "} + u_errorName(err)};
+		}
+	}
+	return *it;
+}
+// Points the break iterator at the UTF-8 data directly, so that no UTF-16 copy is required. Boundaries are byte offsets.
+static icu::BreakIterator &get_break_iterator(BreakType type, std::string_view utf8)
+{
+	auto &it = get_break_iterator(type);
+	UErrorCode err = U_ZERO_ERROR;
+	UText text = UTEXT_INITIALIZER;
+	utext_openUTF8(&text, utf8.data(), static_cast<int64_t>(utf8.size()), &err);
+	// The break iterator keeps a shallow clone of the UText, so ours can be closed right away
+	it.setText(&text, err);
+	utext_close(&text);
+	if(U_FAILURE(err))
+		throw std::runtime_error {std::string {"Failed to set break iterator text: "} + u_errorName(err)};
+	return it;
+}
+
+// ASCII word boundaries according to UAX #29, without the rules that only apply to non-ASCII characters
+enum class AsciiWordClass : uint8_t { Other = 0, Cr, Lf, Newline, Space, Letter, Numeric, ExtendNumLet, MidNumLet, MidNum, SingleQuote };
+// ICU (as of CLDR 42) doesn't treat ':' as MidLetter, and the POSIX locale variants treat '.' as MidNum
+static AsciiWordClass get_ascii_word_class(char c, bool posix)
+{
+	if((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+		return AsciiWordClass::Letter;
+	if(c >= '0' && c <= '9')
+		return AsciiWordClass::Numeric;
+	switch(c) {
+	case '\r':
+		return AsciiWordClass::Cr;
+	case '\n':
+		return AsciiWordClass::Lf;
+	case '\v':
+	case '\f':
+		return AsciiWordClass::Newline;
+	case ' ':
+		return AsciiWordClass::Space;
+	case '_':
+		return AsciiWordClass::ExtendNumLet;
+	case '.':
+		return posix ? AsciiWordClass::MidNum : AsciiWordClass::MidNumLet;
+	case ',':
+	case ';':
+		return AsciiWordClass::MidNum;
+	case '\'':
+		return AsciiWordClass::SingleQuote;
+	default:
+		return AsciiWordClass::Other;
+	}
+}
+// Whether there is a word boundary between str[offset - 1] and str[offset]
+static bool is_ascii_word_boundary(std::string_view str, size_t offset, bool posix)
+{
+	if(offset == 0 || offset >= str.size())
+		return true;
+	using C = AsciiWordClass;
+	auto getClass = [&str, posix](size_t i) { return (i < str.size()) ? get_ascii_word_class(str[i], posix) : C::Other; };
+	auto a = getClass(offset - 1);
+	auto b = getClass(offset);
+	if(a == C::Cr && b == C::Lf)
+		return false; // WB3
+	if(a == C::Cr || a == C::Lf || a == C::Newline || b == C::Cr || b == C::Lf || b == C::Newline)
+		return true; // WB3a, WB3b
+	if(a == C::Space && b == C::Space)
+		return false; // WB3d
+	auto isMidLetter = [](C c) { return c == C::MidNumLet || c == C::SingleQuote; };
+	auto isMidNum = [](C c) { return c == C::MidNum || c == C::MidNumLet || c == C::SingleQuote; };
+	auto isWordChar = [](C c) { return c == C::Letter || c == C::Numeric || c == C::ExtendNumLet; };
+	if(isWordChar(a) && isWordChar(b))
+		return false; // WB5, WB8, WB9, WB10, WB13a, WB13b
+	auto prev = (offset >= 2) ? getClass(offset - 2) : C::Other;
+	auto next = getClass(offset + 1);
+	if(a == C::Letter && isMidLetter(b) && next == C::Letter)
+		return false; // WB6
+	if(prev == C::Letter && isMidLetter(a) && b == C::Letter)
+		return false; // WB7
+	if(prev == C::Numeric && isMidNum(a) && b == C::Numeric)
+		return false; // WB11
+	if(a == C::Numeric && isMidNum(b) && next == C::Numeric)
+		return false; // WB12
+	return true;
+}
+static bool is_posix_locale() { return std::string_view {icu::Locale::getDefault().getVariant()} == "POSIX"; }
+static bool is_ascii_boundary(std::string_view str, size_t offset, BreakType type, bool posix)
+{
+	if(type == BreakType::Word)
+		return is_ascii_word_boundary(str, offset, posix);
+	// Grapheme clusters: Only CR LF is combined
+	return offset == 0 || offset >= str.size() || str[offset - 1] != '\r' || str[offset] != '\n';
+}
+// Line breaking has too many rules that apply to ASCII (numbers, quotes, brackets, etc.) to be worth duplicating
+static bool has_ascii_fast_path(BreakType type) { return type == BreakType::Grapheme || type == BreakType::Word; }
+
+size_t BaseUtf8String::next_boundary(size_t pos, BreakType type) const
+{
+	auto utf8 = view();
+	auto len = length();
+	if(pos >= len)
+		return len;
+	if(len == utf8.size() && has_ascii_fast_path(type)) {
+		auto posix = is_posix_locale();
+		auto offset = pos + 1;
+		while(!is_ascii_boundary(utf8, offset, type, posix))
+			++offset;
+		return offset;
+	}
+	auto &it = get_break_iterator(type, utf8);
+	auto offset = it.following(static_cast<int32_t>(GetByteOffset(pos)));
+	return (offset == icu::BreakIterator::DONE) ? len : GetCodePointIndex(offset);
+}
+size_t BaseUtf8String::previous_boundary(size_t pos, BreakType type) const
+{
+	auto utf8 = view();
+	auto len = length();
+	if(pos == 0)
+		return 0;
+	pos = std::min(pos, len);
+	if(len == utf8.size() && has_ascii_fast_path(type)) {
+		auto posix = is_posix_locale();
+		auto offset = pos - 1;
+		while(!is_ascii_boundary(utf8, offset, type, posix))
+			--offset;
+		return offset;
+	}
+	auto &it = get_break_iterator(type, utf8);
+	auto offset = it.preceding(static_cast<int32_t>(GetByteOffset(pos)));
+	return (offset == icu::BreakIterator::DONE) ? 0 : GetCodePointIndex(offset);
+}
+std::vector<size_t> BaseUtf8String::boundaries(BreakType type) const
+{
+	auto utf8 = view();
+	std::vector<size_t> result;
+	result.push_back(0);
+	if(utf8.empty())
+		return result;
+	if(length() == utf8.size() && has_ascii_fast_path(type)) {
+		auto posix = is_posix_locale();
+		for(size_t offset = 1; offset <= utf8.size(); ++offset) {
+			if(is_ascii_boundary(utf8, offset, type, posix))
+				result.push_back(offset);
+		}
+		return result;
+	}
+	auto &it = get_break_iterator(type, utf8);
+	// Code points are counted incrementally instead of translating every boundary separately
+	size_t prevOffset = 0;
+	size_t idx = 0;
+	for(auto offset = it.next(); offset != icu::BreakIterator::DONE; offset = it.next()) {
+		for(auto i = prevOffset; i < static_cast<size_t>(offset); ++i)
+			idx += ((static_cast<uint8_t>(utf8[i]) & 0xC0) != 0x80) ? 1 : 0;
+		prevOffset = offset;
+		result.push_back(idx);
+	}
+	return result;
+}
+std::vector<Utf8StringView> BaseUtf8String::segments(BreakType type) const
+{
+	auto utf8 = view();
+	std::vector<Utf8StringView> result;
+	auto addSegment = [&](size_t start, size_t end, size_t len) {
+		auto &segment = result.emplace_back();
+		segment.m_data = utf8.data() + start;
+		segment.m_size = end - start;
+		segment.m_length.store(len, std::memory_order_relaxed);
+	};
+	if(utf8.empty())
+		return result;
+	if(length() == utf8.size() && has_ascii_fast_path(type)) {
+		auto posix = is_posix_locale();
+		size_t start = 0;
+		for(size_t offset = 1; offset <= utf8.size(); ++offset) {
+			if(!is_ascii_boundary(utf8, offset, type, posix))
+				continue;
+			addSegment(start, offset, offset - start);
+			start = offset;
+		}
+		return result;
+	}
+	auto &it = get_break_iterator(type, utf8);
+	size_t start = 0;
+	for(auto offset = it.next(); offset != icu::BreakIterator::DONE; offset = it.next()) {
+		size_t len = 0;
+		for(auto i = start; i < static_cast<size_t>(offset); ++i)
+			len += ((static_cast<uint8_t>(utf8[i]) & 0xC0) != 0x80) ? 1 : 0;
+		addSegment(start, offset, len);
+		start = offset;
+	}
+	return result;
+}
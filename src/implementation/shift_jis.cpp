@@ -3,16 +3,85 @@
 
 module;
 
+#include "simd.hpp"
+#include "shift_jis_table.hpp"
+#include "instrumentation.hpp"
+#include <unicode/utf8.h>
+
 module pragma.string.unicode;
 
 import :shift_jis;
+import :parallel;
+import :batch;
+import :file;
 
-static std::vector<uint8_t> g_convTable;
-static bool g_convTableInitialized = false;
-void pragma::string::unicode::init_shift_jis(const std::string &dataFilePath)
+// Number of 16-bit entries in the conversion table (single-byte characters + three double-byte sections)
+static constexpr size_t CONV_TABLE_SIZE = 0x3100;
+
+// UTF-8 encoding of a table entry. Always written as four bytes, of which only the first 'length' are kept.
+struct Utf8Sequence {
+	std::array<char, 3> bytes;
+	uint8_t length;
+};
+static_assert(sizeof(Utf8Sequence) == 4);
+
+struct pragma::string::detail::ShiftJisConversionTable {
+	std::array<uint16_t, CONV_TABLE_SIZE> codePoints;
+	// Pre-encoded entries, so the decoder only has to copy bytes
+	std::array<Utf8Sequence, CONV_TABLE_SIZE> utf8;
+	// True if the table maps 0x00-0x7F to ASCII, in which case ASCII runs can be copied as-is
+	bool asciiIdentity;
+};
+using ConversionTable = pragma::string::detail::ShiftJisConversionTable;
+
+static constexpr Utf8Sequence encode_utf8(uint16_t unicodeValue)
+{
+	Utf8Sequence seq {};
+	if(unicodeValue < 0x80) {
+		seq.bytes[0] = unicodeValue;
+		seq.length = 1;
+	}
+	else if(unicodeValue < 0x800) {
+		seq.bytes[0] = 0xC0 | (unicodeValue >> 6);
+		seq.bytes[1] = 0x80 | (unicodeValue & 0x3f);
+		seq.length = 2;
+	}
+	else {
+		seq.bytes[0] = 0xE0 | (unicodeValue >> 12);
+		seq.bytes[1] = 0x80 | ((unicodeValue & 0xfff) >> 6);
+		seq.bytes[2] = 0x80 | (unicodeValue & 0x3f);
+		seq.length = 3;
+	}
+	return seq;
+}
+
+template<typename TGetCodePoint>
+static constexpr void fill_conversion_table(ConversionTable &table, const TGetCodePoint &getCodePoint)
+{
+	table.asciiIdentity = true;
+	for(size_t i = 0; i < CONV_TABLE_SIZE; ++i) {
+		uint16_t unicodeValue = getCodePoint(i);
+		table.codePoints[i] = unicodeValue;
+		table.utf8[i] = encode_utf8(unicodeValue);
+		if(i < 0x80 && unicodeValue != i)
+			table.asciiIdentity = false;
+	}
+}
+static constexpr ConversionTable build_default_conversion_table()
+{
+	ConversionTable table {};
+	fill_conversion_table(table, [](size_t i) -> uint16_t { return pragma::string::unicode::detail::SHIFT_JIS_TABLE[i]; });
+	return table;
+}
+
+// The built-in table is used until a custom one has been loaded with init_shift_jis
+static constexpr ConversionTable g_defaultConvTable = build_default_conversion_table();
+static std::unique_ptr<ConversionTable> g_customConvTable;
+static std::once_flag g_customConvTableFlag;
+static std::atomic<const ConversionTable *> g_convTable = &g_defaultConvTable;
+
+static void load_conversion_table(const std::string &dataFilePath)
 {
-	if(g_convTableInitialized)
-		return;
 	std::ifstream file(dataFilePath, std::ios::binary | std::ios::ate);
 	if(!file) {
 		throw std::runtime_error {"Failed to open file '" + dataFilePath + "'!"};
@@ -24,76 +93,476 @@ void pragma::string::unicode::init_shift_jis(const std::string &dataFilePath)
 		throw std::runtime_error {"File '" + dataFilePath + "' is empty!"};
 		return;
 	}
+	if(static_cast<size_t>(fileSize) < CONV_TABLE_SIZE * 2) {
+		throw std::runtime_error {"File '" + dataFilePath + "' is not a valid Shift_JIS conversion table!"};
+		return;
+	}
 	file.seekg(0, std::ios::beg);
 
-	g_convTable.resize(fileSize);
-	if(!file.read(reinterpret_cast<char *>(g_convTable.data()), fileSize)) {
+	std::vector<uint8_t> data(CONV_TABLE_SIZE * 2);
+	if(!file.read(reinterpret_cast<char *>(data.data()), data.size())) {
 		throw std::runtime_error {"Failed to read file '" + dataFilePath + "'!"};
 		return;
 	}
 
 	file.close();
-	g_convTableInitialized = true;
+
+	auto table = std::make_unique<ConversionTable>();
+	fill_conversion_table(*table, [&data](size_t i) -> uint16_t { return (data[i * 2] << 8) | data[i * 2 + 1]; });
+	g_customConvTable = std::move(table);
+	g_convTable.store(g_customConvTable.get(), std::memory_order_release);
 }
 
-static std::string sj2utf8(const std::vector<uint8_t> &convTable, const std::string &input)
+void pragma::string::unicode::init_shift_jis(const std::string &dataFilePath)
 {
-	// See https://stackoverflow.com/a/33170901/2482983
-	std::string output(3 * input.length(), ' '); //ShiftJis won't give 4byte UTF8, so max. 3 byte per input char are needed
-	size_t indexInput = 0, indexOutput = 0;
+	// If loading fails, the exception is propagated and the next call will try again
+	std::call_once(g_customConvTableFlag, &load_conversion_table, dataFilePath);
+}
 
-	while(indexInput < input.length()) {
-		char arraySection = ((uint8_t)input[indexInput]) >> 4;
+// Copies the run of ASCII characters at the start of the input to the output and returns its length.
+// The output must have room for at least 3 bytes per remaining input byte, blocks may be written past the end of the run.
+using CopyAsciiFunc = size_t (*)(const uint8_t *input, size_t size, char *output);
+static size_t copy_ascii_scalar(const uint8_t *input, size_t size, char *output)
+{
+	size_t n = 0;
+	for(; n + 8 <= size; n += 8) {
+		uint64_t block;
+		std::memcpy(&block, input + n, 8);
+		if(block & 0x8080808080808080ull)
+			break;
+		std::memcpy(output + n, &block, 8);
+	}
+	while(n < size && input[n] < 0x80) {
+		output[n] = input[n];
+		++n;
+	}
+	return n;
+}
+#ifdef UUNIC_SIMD_X86
+static size_t copy_ascii_sse2(const uint8_t *input, size_t size, char *output)
+{
+	size_t n = 0;
+	for(; n + 16 <= size; n += 16) {
+		auto block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + n));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(output + n), block);
+		auto mask = static_cast<unsigned int>(_mm_movemask_epi8(block));
+		if(mask != 0)
+			return n + pragma::string::detail::count_trailing_zeros(mask);
+	}
+	return n + copy_ascii_scalar(input + n, size - n, output + n);
+}
+UUNIC_TARGET_AVX2 static size_t copy_ascii_avx2(const uint8_t *input, size_t size, char *output)
+{
+	size_t n = 0;
+	for(; n + 32 <= size; n += 32) {
+		auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(input + n));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(output + n), block);
+		auto mask = static_cast<unsigned int>(_mm256_movemask_epi8(block));
+		if(mask != 0)
+			return n + pragma::string::detail::count_trailing_zeros(mask);
+	}
+	return n + copy_ascii_sse2(input + n, size - n, output + n);
+}
+#endif
+static CopyAsciiFunc get_copy_ascii_func()
+{
+#ifdef UUNIC_SIMD_X86
+	if(pragma::string::detail::has_avx2())
+		return &copy_ascii_avx2;
+	return &copy_ascii_sse2;
+#else
+	return &copy_ascii_scalar;
+#endif
+}
 
-		size_t arrayOffset;
-		if(arraySection == 0x8)
-			arrayOffset = 0x100; //these are two-byte shiftjis
-		else if(arraySection == 0x9)
-			arrayOffset = 0x1100;
-		else if(arraySection == 0xE)
-			arrayOffset = 0x2100;
-		else
-			arrayOffset = 0; //this is one byte shiftjis
+// Returns the table offset of the section for double-byte characters starting with the specified lead byte,
+// or 0 if it is a single-byte character
+static size_t get_section_offset(uint8_t c)
+{
+	switch(c >> 4) {
+	case 0x8:
+		return 0x100; //these are two-byte shiftjis
+	case 0x9:
+		return 0x1100;
+	case 0xE:
+		return 0x2100;
+	default:
+		return 0; //this is one byte shiftjis
+	}
+}
+
+// Decodes the input into output, which must have room for 3 * size + 1 bytes. Returns the number of bytes written.
+// If the input ends with a lead byte, it is not consumed.
+static size_t sj2utf8(const ConversionTable &table, const uint8_t *input, size_t size, char *output, size_t &consumed)
+{
+	// See https://stackoverflow.com/a/33170901/2482983
+	static const CopyAsciiFunc copyAscii = get_copy_ascii_func();
+	size_t indexInput = 0, indexOutput = 0;
+	while(indexInput < size) {
+		auto c = input[indexInput];
+		if(c < 0x80 && table.asciiIdentity) {
+			auto n = copyAscii(input + indexInput, size - indexInput, output + indexOutput);
+			indexInput += n;
+			indexOutput += n;
+			continue;
+		}
 
 		//determining real array offset
+		auto arrayOffset = get_section_offset(c);
 		if(arrayOffset) {
-			arrayOffset += (((uint8_t)input[indexInput]) & 0xf) << 8;
-			indexInput++;
-			if(indexInput >= input.length())
+			if(indexInput + 1 >= size)
 				break;
+			arrayOffset += (c & 0xf) << 8;
+			indexInput++;
 		}
-		arrayOffset += (uint8_t)input[indexInput++];
-		arrayOffset <<= 1;
+		arrayOffset += input[indexInput++];
+
+		auto &seq = table.utf8[arrayOffset];
+		std::memcpy(output + indexOutput, &seq, sizeof(seq));
+		indexOutput += seq.length;
+	}
+	consumed = indexInput;
+	return indexOutput;
+}
+
+static bool write_sequence(const ConversionTable &table, size_t arrayOffset, char *output, size_t outputSize, size_t &indexOutput)
+{
+	auto &seq = table.utf8[arrayOffset];
+	if(seq.length > outputSize - indexOutput)
+		return false;
+	std::memcpy(output + indexOutput, seq.bytes.data(), seq.length);
+	indexOutput += seq.length;
+	return true;
+}
 
-		//unicode number is...
-		uint16_t unicodeValue = (convTable[arrayOffset] << 8) | convTable[arrayOffset + 1];
+// Same as sj2utf8, but never writes past the end of the output and continues at indexInput / indexOutput.
+// Stops when the next character doesn't fit into the output, or if the input ends with a lead byte.
+static void sj2utf8_bounded(const ConversionTable &table, const uint8_t *input, size_t size, char *output, size_t outputSize, size_t &indexInput, size_t &indexOutput)
+{
+	while(indexInput < size) {
+		// Bulk conversion for as much of the input as is guaranteed to fit into the remaining output
+		auto outRemaining = outputSize - indexOutput;
+		auto chunk = std::min(size - indexInput, (outRemaining > 0) ? (outRemaining - 1) / 3 : 0);
+		if(chunk > 0) {
+			size_t consumed;
+			indexOutput += ::sj2utf8(table, input + indexInput, chunk, output + indexOutput, consumed);
+			indexInput += consumed;
+			if(consumed == chunk)
+				continue;
+		}
 
-		//converting to UTF8
-		if(unicodeValue < 0x80) {
-			output[indexOutput++] = unicodeValue;
+		// Near the end of the output buffer (or the chunk ended on a lead byte), characters are converted one by one
+		auto c = input[indexInput];
+		auto arrayOffset = get_section_offset(c);
+		if(arrayOffset) {
+			if(indexInput + 1 >= size || !write_sequence(table, arrayOffset + ((c & 0xf) << 8) + input[indexInput + 1], output, outputSize, indexOutput))
+				return;
+			indexInput += 2;
+			continue;
 		}
-		else if(unicodeValue < 0x800) {
-			output[indexOutput++] = 0xC0 | (unicodeValue >> 6);
-			output[indexOutput++] = 0x80 | (unicodeValue & 0x3f);
+		if(!write_sequence(table, c, output, outputSize, indexOutput))
+			return;
+		++indexInput;
+	}
+}
+
+// Returns the number of bytes sj2utf8 would write for the input
+static size_t sj2utf8_length(const ConversionTable &table, const uint8_t *input, size_t size)
+{
+	size_t indexInput = 0, length = 0;
+	while(indexInput < size) {
+		if(table.asciiIdentity) {
+			auto start = indexInput;
+			for(; indexInput + 8 <= size; indexInput += 8) {
+				uint64_t block;
+				std::memcpy(&block, input + indexInput, 8);
+				if(block & 0x8080808080808080ull)
+					break;
+			}
+			while(indexInput < size && input[indexInput] < 0x80)
+				++indexInput;
+			length += indexInput - start;
+			if(indexInput >= size)
+				break;
 		}
-		else {
-			output[indexOutput++] = 0xE0 | (unicodeValue >> 12);
-			output[indexOutput++] = 0x80 | ((unicodeValue & 0xfff) >> 6);
-			output[indexOutput++] = 0x80 | (unicodeValue & 0x3f);
+		auto c = input[indexInput];
+		auto arrayOffset = get_section_offset(c);
+		if(arrayOffset) {
+			if(indexInput + 1 >= size)
+				break;
+			arrayOffset += (c & 0xf) << 8;
+			indexInput++;
 		}
+		arrayOffset += input[indexInput++];
+		length += table.utf8[arrayOffset].length;
+	}
+	return length;
+}
+
+// Returns pos if a character starts there, otherwise pos + 1. prevStart has to be a known character start before pos.
+static size_t find_character_start(const uint8_t *input, size_t prevStart, size_t pos)
+{
+	// Any byte that can't be a lead byte ends a character (either as a single-byte character or as a trail byte),
+	// and the lead byte candidates following it have to pair up.
+	auto start = pos;
+	while(start > prevStart && get_section_offset(input[start - 1]) != 0)
+		--start;
+	return ((pos - start) % 2 == 0) ? pos : pos + 1;
+}
+
+static std::string sj2utf8(const ConversionTable &table, std::string_view input)
+{
+	UUNIC_TIME_SCOPE(ShiftJisDecodeTime);
+	UUNIC_COUNT(ShiftJisDecodedBytes, input.size());
+	//ShiftJis won't give 4byte UTF8, so max. 3 byte per input char are needed (+1 since sequences are always written as 4 bytes)
+	std::string output;
+	output.resize_and_overwrite(3 * input.length() + 1, [&](char *buf, size_t) {
+		size_t consumed;
+		return ::sj2utf8(table, reinterpret_cast<const uint8_t *>(input.data()), input.length(), buf, consumed);
+	});
+	UUNIC_COUNT_STRING_ALLOCATION(output);
+	return output;
+}
+
+const ConversionTable &pragma::string::detail::get_shift_jis_conversion_table() { return *g_convTable.load(std::memory_order_acquire); }
+size_t pragma::string::detail::get_shift_jis_utf8_size(const ConversionTable &table, std::string_view input) { return sj2utf8_length(table, reinterpret_cast<const uint8_t *>(input.data()), input.size()); }
+void pragma::string::detail::shift_jis_to_utf8(const ConversionTable &table, std::string_view input, char *output, size_t outputSize)
+{
+	UUNIC_TIME_SCOPE(ShiftJisDecodeTime);
+	UUNIC_COUNT(ShiftJisDecodedBytes, input.size());
+	size_t indexInput = 0, indexOutput = 0;
+	::sj2utf8_bounded(table, reinterpret_cast<const uint8_t *>(input.data()), input.size(), output, outputSize, indexInput, indexOutput);
+}
+
+std::string pragma::string::detail::shift_jis_to_utf8_chunked(std::string_view input, size_t chunkSize, const std::function<void(size_t)> &onChunkDecoded)
+{
+	UUNIC_TIME_SCOPE(ShiftJisDecodeTime);
+	UUNIC_COUNT(ShiftJisDecodedBytes, input.size());
+	auto &table = *g_convTable.load(std::memory_order_acquire);
+	auto *in = reinterpret_cast<const uint8_t *>(input.data());
+
+	// The output size of every chunk is determined first, so that the output only has to be allocated once
+	std::vector<size_t> boundaries {0};
+	std::vector<size_t> offsets {0};
+	while(boundaries.back() < input.size()) {
+		auto start = boundaries.back();
+		auto end = (input.size() - start > chunkSize) ? find_character_start(in, start, start + chunkSize) : input.size();
+		offsets.push_back(offsets.back() + sj2utf8_length(table, in + start, end - start));
+		boundaries.push_back(end);
 	}
 
-	output.resize(indexOutput); //remove the unnecessary bytes
+	std::string output;
+	output.resize_and_overwrite(offsets.back(), [&](char *buf, size_t) {
+		for(size_t i = 0; i + 1 < boundaries.size(); ++i) {
+			size_t indexInput = 0, indexOutput = 0;
+			::sj2utf8_bounded(table, in + boundaries[i], boundaries[i + 1] - boundaries[i], buf + offsets[i], offsets[i + 1] - offsets[i], indexInput, indexOutput);
+			onChunkDecoded(boundaries[i + 1]);
+		}
+		return offsets.back();
+	});
+	UUNIC_COUNT_STRING_ALLOCATION(output);
 	return output;
 }
 
-std::string pragma::string::unicode::shift_jis_to_utf8(const std::string &input, bool validate)
+std::string pragma::string::unicode::shift_jis_to_utf8(const std::string &input, bool validate, const ShiftJisValidationOptions &validationOptions)
 {
-	if(!g_convTableInitialized)
-		throw std::runtime_error {"Shift_JIS has not been initialized! Make sure to run init_shift_jis first!"};
 	if(validate) {
-		if(validate_shift_jis(input.data()) == 0)
+		if(!validate_shift_jis_buffer(input, validationOptions).valid)
 			return input;
 	}
-	return ::sj2utf8(g_convTable, input);
+	return ::sj2utf8(*g_convTable.load(std::memory_order_acquire), input);
+}
+
+////////////////////
+
+// Unicode (BMP) to Shift_JIS lookup, as a two-level page table keyed by the high and low byte of the code point.
+// Single-byte characters are stored as-is, double-byte characters as (lead << 8) | trail.
+struct ReverseConversionTable {
+	static constexpr uint16_t NO_MAPPING = 0xFFFF;
+	static constexpr size_t PAGE_SIZE = 256;
+	// Page 0 is empty and shared by all code point ranges without any mappings
+	std::array<uint16_t, 256> pageIndices {};
+	std::vector<uint16_t> pages;
+
+	uint16_t Lookup(uint16_t codePoint) const { return pages[pageIndices[codePoint >> 8] * PAGE_SIZE + (codePoint & 0xFF)]; }
+};
+
+static std::unique_ptr<ReverseConversionTable> build_reverse_conversion_table(const ConversionTable &table)
+{
+	auto reverseTable = std::make_unique<ReverseConversionTable>();
+	reverseTable->pages.resize(ReverseConversionTable::PAGE_SIZE, ReverseConversionTable::NO_MAPPING);
+	auto addMapping = [&reverseTable](uint16_t codePoint, uint16_t code) {
+		if(codePoint == 0xFFFD)
+			return; // Unmapped
+		auto &pageIndex = reverseTable->pageIndices[codePoint >> 8];
+		if(pageIndex == 0) {
+			pageIndex = reverseTable->pages.size() / ReverseConversionTable::PAGE_SIZE;
+			reverseTable->pages.resize(reverseTable->pages.size() + ReverseConversionTable::PAGE_SIZE, ReverseConversionTable::NO_MAPPING);
+		}
+		// If multiple Shift_JIS characters map to the same code point, the first one wins
+		auto &entry = reverseTable->pages[pageIndex * ReverseConversionTable::PAGE_SIZE + (codePoint & 0xFF)];
+		if(entry == ReverseConversionTable::NO_MAPPING)
+			entry = code;
+	};
+	for(uint16_t c = 0; c < 0x100; ++c) {
+		if(get_section_offset(c) == 0)
+			addMapping(table.codePoints[c], c);
+	}
+	for(uint16_t lead = 0x80; lead < 0x100; ++lead) {
+		auto sectionOffset = get_section_offset(lead);
+		if(sectionOffset == 0)
+			continue;
+		for(uint16_t trail = 0; trail < 0x100; ++trail)
+			addMapping(table.codePoints[sectionOffset + ((lead & 0xf) << 8) + trail], (lead << 8) | trail);
+	}
+	return reverseTable;
+}
+
+static const ReverseConversionTable &get_reverse_conversion_table(const ConversionTable &table)
+{
+	// The built-in and custom tables can both be active at different times, so each has its own reverse table
+	static std::once_flag defaultFlag, customFlag;
+	static std::unique_ptr<ReverseConversionTable> defaultReverseTable, customReverseTable;
+	auto isDefault = (&table == &g_defaultConvTable);
+	auto &reverseTable = isDefault ? defaultReverseTable : customReverseTable;
+	std::call_once(isDefault ? defaultFlag : customFlag, [&]() { reverseTable = build_reverse_conversion_table(table); });
+	return *reverseTable;
+}
+
+std::string pragma::string::unicode::utf8_to_shift_jis(std::string_view input, const ShiftJisEncodeOptions &options)
+{
+	static const CopyAsciiFunc copyAscii = get_copy_ascii_func();
+	auto &table = *g_convTable.load(std::memory_order_acquire);
+	auto &reverseTable = get_reverse_conversion_table(table);
+	auto *in = reinterpret_cast<const uint8_t *>(input.data());
+	auto size = input.size();
+	auto unmappedOffset = std::string::npos;
+	std::string output;
+	// Every character is at most as long in Shift_JIS as in UTF-8, unless the table maps ASCII to double-byte characters
+	output.resize_and_overwrite(table.asciiIdentity ? size : size * 2, [&](char *out, size_t) {
+		size_t indexInput = 0, indexOutput = 0;
+		while(indexInput < size) {
+			if(in[indexInput] < 0x80 && table.asciiIdentity) {
+				auto n = copyAscii(in + indexInput, size - indexInput, out + indexOutput);
+				indexInput += n;
+				indexOutput += n;
+				continue;
+			}
+			auto start = indexInput;
+			int32_t seqLen = 0;
+			UChar32 c;
+			U8_NEXT(in + indexInput, seqLen, static_cast<int32_t>(std::min<size_t>(size - indexInput, U8_MAX_LENGTH)), c);
+			indexInput += seqLen;
+
+			auto code = (c >= 0 && c <= 0xFFFF) ? reverseTable.Lookup(c) : ReverseConversionTable::NO_MAPPING;
+			if(code == ReverseConversionTable::NO_MAPPING) {
+				switch(options.policy) {
+				case UnmappableCharPolicy::Replace:
+					out[indexOutput++] = options.replacementChar;
+					break;
+				case UnmappableCharPolicy::Skip:
+					break;
+				case UnmappableCharPolicy::Throw:
+					unmappedOffset = start;
+					return indexOutput;
+				}
+				continue;
+			}
+			if(code > 0xFF)
+				out[indexOutput++] = static_cast<char>(code >> 8);
+			out[indexOutput++] = static_cast<char>(code & 0xFF);
+		}
+		return indexOutput;
+	});
+	if(unmappedOffset != std::string::npos)
+		throw std::runtime_error {"Character at byte offset " + std::to_string(unmappedOffset) + " can not be represented in Shift_JIS!"};
+	UUNIC_COUNT_STRING_ALLOCATION(output);
+	return output;
+}
+
+////////////////////
+
+pragma::string::unicode::ShiftJisDecoder::Result pragma::string::unicode::ShiftJisDecoder::Decode(std::string_view input, std::span<char8_t> output)
+{
+	UUNIC_TIME_SCOPE(ShiftJisDecodeTime);
+	auto &table = *g_convTable.load(std::memory_order_acquire);
+	auto *in = reinterpret_cast<const uint8_t *>(input.data());
+	auto *out = reinterpret_cast<char *>(output.data());
+	size_t inPos = 0, outPos = 0;
+	if(m_leadByte) {
+		if(input.empty() || !write_sequence(table, get_section_offset(*m_leadByte) + ((*m_leadByte & 0xf) << 8) + in[0], out, output.size(), outPos))
+			return {};
+		m_leadByte = {};
+		inPos = 1;
+	}
+	::sj2utf8_bounded(table, in, input.size(), out, output.size(), inPos, outPos);
+	if(inPos + 1 == input.size() && get_section_offset(in[inPos])) {
+		// Carried over to the next chunk
+		m_leadByte = in[inPos];
+		++inPos;
+	}
+	UUNIC_COUNT(ShiftJisDecodedBytes, inPos);
+	return {inPos, outPos};
+}
+pragma::string::unicode::ShiftJisDecoder::Result pragma::string::unicode::ShiftJisDecoder::Finish(std::span<char8_t> output)
+{
+	if(!m_leadByte)
+		return {};
+	// Truncated double-byte character
+	constexpr std::array<char8_t, 3> replacementChar {0xEF, 0xBF, 0xBD};
+	if(output.size() < replacementChar.size())
+		return {};
+	std::copy(replacementChar.begin(), replacementChar.end(), output.begin());
+	m_leadByte = {};
+	return {0, replacementChar.size()};
+}
+void pragma::string::unicode::ShiftJisDecoder::Reset() { m_leadByte = {}; }
+
+////////////////////
+
+std::string pragma::string::unicode::shift_jis_to_utf8_parallel(std::string_view input, const ParallelOptions &options)
+{
+	auto &table = *g_convTable.load(std::memory_order_acquire);
+	auto *in = reinterpret_cast<const uint8_t *>(input.data());
+	// More chunks than threads, so that threads which finish early can pick up remaining work
+	auto maxChunks = (options.GetThreadCount() > 1 || options.executor) ? options.GetThreadCount() * 4 : 1;
+	auto numChunks = std::clamp<size_t>(input.size() / std::max<size_t>(options.minChunkSize, 1), 1, maxChunks);
+	if(numChunks == 1)
+		return ::sj2utf8(table, input);
+	// Counted on the calling thread only, as the wall-clock time of the entire conversion
+	UUNIC_TIME_SCOPE(ShiftJisDecodeTime);
+	UUNIC_COUNT(ShiftJisDecodedBytes, input.size());
+
+	std::vector<size_t> boundaries(numChunks + 1);
+	boundaries.back() = input.size();
+	for(size_t i = 1; i < numChunks; ++i)
+		boundaries[i] = find_character_start(in, boundaries[i - 1], std::max(boundaries[i - 1], input.size() * i / numChunks));
+
+	// The output size of every chunk is determined first, so that all chunks can be decoded directly into their final location
+	std::vector<size_t> offsets(numChunks + 1);
+	run_parallel(numChunks, [&](size_t i) { offsets[i + 1] = sj2utf8_length(table, in + boundaries[i], boundaries[i + 1] - boundaries[i]); }, options);
+	std::inclusive_scan(offsets.begin(), offsets.end(), offsets.begin());
+
+	std::string output;
+	std::exception_ptr exception;
+	output.resize_and_overwrite(offsets.back(), [&](char *buf, size_t) {
+		try {
+			run_parallel(
+			  numChunks,
+			  [&](size_t i) {
+				  size_t indexInput = 0, indexOutput = 0;
+				  ::sj2utf8_bounded(table, in + boundaries[i], boundaries[i + 1] - boundaries[i], buf + offsets[i], offsets[i + 1] - offsets[i], indexInput, indexOutput);
+			  },
+			  options);
+		}
+		catch(...) {
+			exception = std::current_exception();
+			return size_t {0};
+		}
+		return offsets.back();
+	});
+	if(exception)
+		std::rethrow_exception(exception);
+	UUNIC_COUNT_STRING_ALLOCATION(output);
+	return output;
 }
@@ -24,6 +24,8 @@ SOFTWARE.
 
 module;
 
+#include "simd.hpp"
+
 module pragma.string.unicode;
 
 import :shift_jis;
@@ -31,29 +33,35 @@ import :shift_jis;
 // Source: https://github.com/drojaazu/jstrings/blob/master/inc/enc_shiftjis.hpp
 
 using uint = uint32_t;
-using byte_t = char;
 using u8 = uint8_t;
-bool m_skip_jis0201 = false;
-bool m_include_crlf = false;
-static uint validate_shift_jis(byte_t const *data)
+using pragma::string::unicode::ShiftJisValidationOptions;
+using pragma::string::unicode::ShiftJisValidationResult;
+static uint validate_shift_jis(u8 const *data, size_t size, const ShiftJisValidationOptions &options)
 {
+	if(size == 0)
+		return 0;
 	/*
 		JIS X 0201 - 8-bit characters (including 7-bit ASCII)
 		excludes non-printable (control code) and reserved bytes
 		(but include tab (0x09))
 	*/
-	u8 c_hi = static_cast<uint8_t>(*data);
+	u8 c_hi = *data;
 	// clang-format off
 	if ((c_hi == 0x09) || (c_hi >= 0x20) & (c_hi <= 0x7e)
-		|| ((! m_skip_jis0201) && ((c_hi >= 0xa1) & (c_hi <= 0xdf)))
+		|| ((! options.skipJis0201) && ((c_hi >= 0xa1) & (c_hi <= 0xdf)))
 	)
 		return 1;
 	// clang-format on
 
+	if(options.includeCrlf && c_hi == 0x0a)
+		return 1;
+	if(size < 2)
+		return 0;
+
 	// JIS X 0208 - 16 bit characters
-	u8 c_lo = static_cast<uint8_t>(*(data + 1));
+	u8 c_lo = *(data + 1);
 
-	if(m_include_crlf && (c_hi == 0x0a || (c_hi == 0x0d && c_lo == 0x0a)))
+	if(options.includeCrlf && (c_hi == 0x0d && c_lo == 0x0a))
 		return 1;
 
 	// sjis lower byte can never be these values
@@ -117,4 +125,114 @@ static uint validate_shift_jis(byte_t const *data)
 	// clang-format on
 	return 0;
 }
-uint32_t pragma::string::unicode::validate_shift_jis(const std::string &data) { return ::validate_shift_jis(data.c_str()); }
+
+// Returns the number of leading bytes that are single-byte characters which are valid on their own
+// (tab, printable ASCII, JIS X 0201 katakana and line feeds, depending on the options).
+// Carriage returns are left to the scalar path, since they are only valid when followed by a line feed.
+using ScanSingleByteFunc = size_t (*)(const u8 *data, size_t size, const ShiftJisValidationOptions &options);
+static bool is_single_byte(u8 c, const ShiftJisValidationOptions &options) { return c == 0x09 || (c >= 0x20 && c <= 0x7e) || (!options.skipJis0201 && c >= 0xa1 && c <= 0xdf) || (options.includeCrlf && c == 0x0a); }
+static size_t scan_single_byte_scalar(const u8 *data, size_t size, const ShiftJisValidationOptions &options)
+{
+	size_t n = 0;
+	while(n < size && is_single_byte(data[n], options))
+		++n;
+	return n;
+}
+#ifdef UUNIC_SIMD_X86
+// SSE2 only has signed byte comparisons, so unsigned ranges are tested with lo <= c <= hi <=> min(c - lo, hi - lo) == c - lo
+static __m128i in_range(__m128i c, u8 lo, u8 hi)
+{
+	auto offset = _mm_sub_epi8(c, _mm_set1_epi8(static_cast<char>(lo)));
+	return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(static_cast<char>(hi - lo))), offset);
+}
+static size_t scan_single_byte_sse2(const u8 *data, size_t size, const ShiftJisValidationOptions &options)
+{
+	auto katakana = _mm_set1_epi8(options.skipJis0201 ? 0 : -1);
+	auto lineFeed = _mm_set1_epi8(options.includeCrlf ? 0x0a : 0x09);
+	size_t n = 0;
+	for(; n + 16 <= size; n += 16) {
+		auto c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + n));
+		auto valid = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(0x09)), in_range(c, 0x20, 0x7e));
+		valid = _mm_or_si128(valid, _mm_and_si128(in_range(c, 0xa1, 0xdf), katakana));
+		valid = _mm_or_si128(valid, _mm_cmpeq_epi8(c, lineFeed));
+		auto mask = static_cast<unsigned int>(_mm_movemask_epi8(valid)) ^ 0xFFFFu;
+		if(mask != 0)
+			return n + pragma::string::detail::count_trailing_zeros(mask);
+	}
+	return n + scan_single_byte_scalar(data + n, size - n, options);
+}
+UUNIC_TARGET_AVX2 static __m256i in_range_avx2(__m256i c, u8 lo, u8 hi)
+{
+	auto offset = _mm256_sub_epi8(c, _mm256_set1_epi8(static_cast<char>(lo)));
+	return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(static_cast<char>(hi - lo))), offset);
+}
+UUNIC_TARGET_AVX2 static size_t scan_single_byte_avx2(const u8 *data, size_t size, const ShiftJisValidationOptions &options)
+{
+	auto katakana = _mm256_set1_epi8(options.skipJis0201 ? 0 : -1);
+	auto lineFeed = _mm256_set1_epi8(options.includeCrlf ? 0x0a : 0x09);
+	size_t n = 0;
+	for(; n + 32 <= size; n += 32) {
+		auto c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + n));
+		auto valid = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(0x09)), in_range_avx2(c, 0x20, 0x7e));
+		valid = _mm256_or_si256(valid, _mm256_and_si256(in_range_avx2(c, 0xa1, 0xdf), katakana));
+		valid = _mm256_or_si256(valid, _mm256_cmpeq_epi8(c, lineFeed));
+		auto mask = ~static_cast<unsigned int>(_mm256_movemask_epi8(valid));
+		if(mask != 0)
+			return n + pragma::string::detail::count_trailing_zeros(mask);
+	}
+	return n + scan_single_byte_sse2(data + n, size - n, options);
+}
+#endif
+static ScanSingleByteFunc get_scan_single_byte_func()
+{
+#ifdef UUNIC_SIMD_X86
+	if(pragma::string::detail::has_avx2())
+		return &scan_single_byte_avx2;
+	return &scan_single_byte_sse2;
+#else
+	return &scan_single_byte_scalar;
+#endif
+}
+
+// Validity of all double-byte characters, indexed by (lead << 8) | trail. The lead byte range 0x80-0xFF is
+// independent of the validation options, so it is built once and lets the buffer scan skip the branchy checks above.
+class DoubleByteTable {
+  public:
+	DoubleByteTable()
+	{
+		for(uint lead = 0x80; lead < 0x100; ++lead) {
+			for(uint trail = 0; trail < 0x100; ++trail) {
+				u8 pair[2] {static_cast<u8>(lead), static_cast<u8>(trail)};
+				if(::validate_shift_jis(pair, 2, {.skipJis0201 = true}) == 2)
+					m_bits[lead - 0x80][trail / 64] |= uint64_t {1} << (trail % 64);
+			}
+		}
+	}
+	bool IsValid(u8 lead, u8 trail) const { return lead >= 0x80 && (m_bits[lead - 0x80][trail / 64] >> (trail % 64)) & 1; }
+  private:
+	std::array<std::array<uint64_t, 4>, 0x80> m_bits {};
+};
+
+uint32_t pragma::string::unicode::validate_shift_jis(const std::string &data, const ShiftJisValidationOptions &options) { return ::validate_shift_jis(reinterpret_cast<const u8 *>(data.data()), data.size(), options); }
+ShiftJisValidationResult pragma::string::unicode::validate_shift_jis_buffer(std::string_view data, const ShiftJisValidationOptions &options)
+{
+	static const ScanSingleByteFunc scanSingleByte = get_scan_single_byte_func();
+	static const DoubleByteTable doubleByteTable {};
+	auto *bytes = reinterpret_cast<const u8 *>(data.data());
+	size_t offset = 0;
+	while(offset < data.size()) {
+		offset += scanSingleByte(bytes + offset, data.size() - offset, options);
+		// Double-byte characters and control codes are checked individually until the next single-byte run
+		while(offset < data.size() && !is_single_byte(bytes[offset], options)) {
+			if(offset + 1 < data.size() && doubleByteTable.IsValid(bytes[offset], bytes[offset + 1])) {
+				offset += 2;
+				continue;
+			}
+			auto len = ::validate_shift_jis(bytes + offset, data.size() - offset, options);
+			if(len == 0)
+				return {false, offset};
+			offset += len;
+		}
+	}
+	return {};
+}
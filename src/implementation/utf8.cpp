@@ -4,352 +4,1024 @@
 module;
 
 #include <unicode/unistr.h>
-#include <unicode/schriter.h>
+#include <unicode/casemap.h>
+#include <unicode/bytestream.h>
+#include <unicode/utf8.h>
+#include <unicode/utf16.h>
+#include <unicode/uchar.h>
+#include <unicode/locid.h>
 #include <string_view>
+#include "search.hpp"
+#include "validate_utf8.hpp"
+#include "instrumentation.hpp"
 
 module pragma.string.unicode;
 
 import :utf8;
+import :batch;
 
 using namespace pragma::string;
 
-BaseUtf8String::BaseUtf8String() : m_string {std::make_unique<icu::UnicodeString>()} {}
-BaseUtf8String::BaseUtf8String(std::unique_ptr<icu_78::UnicodeString> &&str) : m_string {std::move(str)} {}
-BaseUtf8String::~BaseUtf8String() {}
-icu_78::UnicodeString &BaseUtf8String::GetIcuString() { return *m_string; }
-const icu_78::UnicodeString &BaseUtf8String::GetIcuString() const { return *m_string; }
-size_t BaseUtf8String::length() const { return m_string->countChar32(); }
-size_t BaseUtf8String::size() const { return length(); }
+// Returned by at(), front() and back() for out-of-range indices (same as icu::UnicodeString::char32At)
+static constexpr Char32 INVALID_CHAR = 0xFFFF;
+static constexpr Char32 REPLACEMENT_CHAR = 0xFFFD;
+
+static void append_code_point(std::string &str, Char32 c)
+{
+	if(c < 0 || c > 0x10FFFF || U_IS_SURROGATE(c))
+		c = REPLACEMENT_CHAR;
+	char buf[U8_MAX_LENGTH];
+	int32_t len = 0;
+	U8_APPEND_UNSAFE(buf, len, c);
+	str.append(buf, len);
+}
+
+// Returns the byte offset of the first ill-formed sequence, or the size of the string if it is well-formed UTF-8
+static size_t find_invalid_utf8(std::string_view utf8) { return detail::find_invalid_utf8(utf8.data(), utf8.size()); }
+
+// Appends UTF-8 data to str. Ill-formed sequences are replaced with U+FFFD, the same way icu::UnicodeString::fromUTF8 does.
+static void append_utf8(std::string &str, std::string_view utf8)
+{
+	UUNIC_COUNT_STRING_GROWTH(str);
+	// Fast path: Everything before the first ill-formed sequence can be copied as-is
+	auto valid = find_invalid_utf8(utf8);
+	str.append(utf8.data(), valid);
+	auto *data = reinterpret_cast<const uint8_t *>(utf8.data());
+	auto len = static_cast<int32_t>(utf8.size());
+	auto i = static_cast<int32_t>(valid);
+	while(i < len) {
+		auto start = i;
+		UChar32 c;
+		U8_NEXT(data, i, len, c);
+		if(c < 0)
+			append_code_point(str, REPLACEMENT_CHAR);
+		else
+			str.append(utf8.data() + start, i - start);
+	}
+}
+
+// Unpaired surrogates are replaced with U+FFFD
+static void append_utf16(std::string &str, std::u16string_view utf16)
+{
+	UUNIC_TIME_SCOPE(TranscodeTime);
+	UUNIC_COUNT(Utf16ToUtf8Count, 1);
+	UUNIC_COUNT(TranscodedBytes, utf16.size() * sizeof(char16_t));
+	UUNIC_COUNT_STRING_GROWTH(str);
+	str.reserve(str.size() + utf16.size());
+	auto len = static_cast<int32_t>(utf16.size());
+	for(int32_t i = 0; i < len;) {
+		UChar32 c;
+		U16_NEXT(utf16.data(), i, len, c);
+		append_code_point(str, c);
+	}
+}
+
+bool pragma::string::detail::is_well_formed_utf8(std::string_view utf8) { return ::find_invalid_utf8(utf8) == utf8.size(); }
+
+// Returns utf8 if it is well-formed, otherwise a sanitized copy of it that is stored in buffer
+static std::string_view sanitize_utf8(std::string_view utf8, std::string &buffer)
+{
+	if(find_invalid_utf8(utf8) == utf8.size())
+		return utf8;
+	append_utf8(buffer, utf8);
+	return buffer;
+}
+
+static std::string utf8_from(std::string_view utf8)
+{
+	std::string str;
+	append_utf8(str, utf8);
+	return str;
+}
+static std::string adopt_utf8(std::string &&utf8)
+{
+	if(find_invalid_utf8(utf8) == utf8.size())
+		return std::move(utf8);
+	return utf8_from(std::string_view {utf8});
+}
+
+static size_t get_sequence_length(uint8_t lead)
+{
+	if(lead < 0x80)
+		return 1;
+	if(lead < 0xE0)
+		return 2;
+	if(lead < 0xF0)
+		return 3;
+	return 4;
+}
+
+static Char32 decode_at(std::string_view str, size_t offset)
+{
+	if(offset >= str.size())
+		return INVALID_CHAR;
+	auto i = static_cast<int32_t>(offset);
+	UChar32 c;
+	U8_NEXT_UNSAFE(reinterpret_cast<const uint8_t *>(str.data()), i, c);
+	return c;
+}
+static size_t count_code_points(const char *data, size_t size)
+{
+	size_t len = 0;
+	for(size_t i = 0; i < size; ++i)
+		len += ((static_cast<uint8_t>(data[i]) & 0xC0) != 0x80) ? 1 : 0;
+	return len;
+}
+static size_t skip_code_points(std::string_view str, size_t offset, size_t count)
+{
+	while(count > 0 && offset < str.size()) {
+		offset += get_sequence_length(str[offset]);
+		--count;
+	}
+	return std::min(offset, str.size());
+}
+
+// Converts the case of ASCII characters in place, until the first non-ASCII byte. Returns the number of bytes that were mapped.
+static size_t map_ascii_case_scalar(char *data, size_t size, bool upper, size_t offset)
+{
+	auto first = upper ? 'a' : 'A';
+	for(; offset < size; ++offset) {
+		auto c = static_cast<uint8_t>(data[offset]);
+		if(c >= 0x80)
+			break;
+		if(static_cast<uint8_t>(c - first) < 26)
+			data[offset] = static_cast<char>(c ^ 0x20);
+	}
+	return offset;
+}
+static size_t map_ascii_case(char *data, size_t size, bool upper)
+{
+	size_t offset = 0;
+#ifdef UUNIC_SIMD_X86
+	// Shifts the letter range to the bottom of the signed range, so that a single signed comparison checks both bounds
+	auto bias = _mm_set1_epi8(static_cast<char>(0x80 - (upper ? 'a' : 'A')));
+	auto limit = _mm_set1_epi8(static_cast<char>(0x80 + 26));
+	auto caseBit = _mm_set1_epi8(0x20);
+	for(; offset + sizeof(__m128i) <= size; offset += sizeof(__m128i)) {
+		auto block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offset));
+		if(_mm_movemask_epi8(block) != 0)
+			break;
+		auto isLetter = _mm_cmplt_epi8(_mm_add_epi8(block, bias), limit);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(data + offset), _mm_xor_si128(block, _mm_and_si128(isLetter, caseBit)));
+	}
+#endif
+	return map_ascii_case_scalar(data, size, upper, offset);
+}
+// Some locales map ASCII letters differently: Turkic locales map 'i' and 'I' to dotted/dotless variants, and in
+// Lithuanian the mapping depends on the combining marks that follow. ASCII can't be mapped directly for those.
+static bool has_ascii_case_mapping()
+{
+	std::string_view lang = icu::Locale::getDefault().getLanguage();
+	return lang != "tr" && lang != "az" && lang != "lt";
+}
+static void map_case(std::string &utf8, bool upper)
+{
+	size_t offset = 0;
+	if(has_ascii_case_mapping()) {
+		offset = map_ascii_case(utf8.data(), utf8.size(), upper);
+		if(offset == utf8.size())
+			return;
+		// The mapping of some characters depends on the preceding characters (e.g. the Greek final sigma),
+		// so ICU has to start at the beginning of the word
+		while(offset > 0) {
+			auto c = utf8[offset - 1];
+			auto isCaseIgnorable = (c == '\'' || c == '.' || c == ':' || c == '^' || c == '`');
+			if(!isCaseIgnorable && !((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')))
+				break;
+			--offset;
+		}
+	}
+	std::string result;
+	UUNIC_COUNT_STRING_GROWTH(result);
+	result.reserve(utf8.size());
+	result.append(utf8, 0, offset);
+	icu::StringByteSink<std::string> sink {&result, static_cast<int32_t>(utf8.size() - offset)};
+	UErrorCode err = U_ZERO_ERROR;
+	icu::StringPiece src {utf8.data() + offset, static_cast<int32_t>(utf8.size() - offset)};
+	if(upper)
+		icu::CaseMap::utf8ToUpper(nullptr, 0, src, sink, nullptr, err);
+	else
+		icu::CaseMap::utf8ToLower(nullptr, 0, src, sink, nullptr, err);
+	if(U_FAILURE(err))
+		return;
+	utf8 = std::move(result);
+}
+
+// Simple (1:1) case folding, which doesn't require a buffer
+static Char32 fold_case(Char32 c)
+{
+	if(c < 0x80)
+		return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+	return u_foldCase(c, U_FOLD_CASE_DEFAULT);
+}
+// Decodes the code point at offset of well-formed UTF-8 and moves offset to the next one
+static Char32 next_code_point(std::string_view str, size_t &offset)
+{
+	auto *p = reinterpret_cast<const uint8_t *>(str.data()) + offset;
+	if(p[0] < 0x80) {
+		++offset;
+		return p[0];
+	}
+	int32_t i = 0;
+	UChar32 c;
+	U8_NEXT_UNSAFE(p, i, c);
+	offset += i;
+	return c;
+}
+
+static constexpr size_t BREADCRUMB_INTERVAL = 64;
+// Shorter strings are scanned directly
+static constexpr size_t BREADCRUMB_MIN_SIZE = 256;
 
-size_t BaseUtf8String::find(Char8 c, size_t startPos) const
+BaseUtf8String::BaseUtf8String() {}
+// The moved-from string's length is reset to npos rather than 0, since its data isn't necessarily empty
+BaseUtf8String::BaseUtf8String(BaseUtf8String &&other) noexcept
+    : m_utf16 {std::move(other.m_utf16)}, m_length {other.m_length.exchange(npos, std::memory_order_relaxed)}, m_breadcrumbs {other.m_breadcrumbs.exchange(nullptr, std::memory_order_relaxed)}
+{
+}
+BaseUtf8String &BaseUtf8String::operator=(BaseUtf8String &&other) noexcept
+{
+	if(&other == this)
+		return *this;
+	InvalidateCache();
+	m_utf16 = std::move(other.m_utf16);
+	m_length.store(other.m_length.exchange(npos, std::memory_order_relaxed), std::memory_order_relaxed);
+	m_breadcrumbs.store(other.m_breadcrumbs.exchange(nullptr, std::memory_order_relaxed), std::memory_order_relaxed);
+	return *this;
+}
+BaseUtf8String::~BaseUtf8String() { delete m_breadcrumbs.load(std::memory_order_relaxed); }
+const icu_78::UnicodeString &BaseUtf8String::GetIcuString()
+{
+	if(!m_utf16) {
+		UUNIC_TIME_SCOPE(TranscodeTime);
+		auto utf8 = view();
+		m_utf16 = std::make_unique<icu::UnicodeString>(icu::UnicodeString::fromUTF8(icu::StringPiece {utf8.data(), static_cast<int32_t>(utf8.size())}));
+		UUNIC_COUNT(Utf8ToUtf16Count, 1);
+		UUNIC_COUNT(TranscodedBytes, utf8.size());
+		UUNIC_COUNT_ALLOCATION(sizeof(icu::UnicodeString));
+#ifdef UUNIC_ENABLE_INSTRUMENTATION
+		// Short strings are stored in the internal buffer of the UnicodeString
+		constexpr auto stackBufferSize = static_cast<int32_t>((UNISTR_OBJECT_SIZE - sizeof(void *) - 2) / U_SIZEOF_UCHAR);
+		if(m_utf16->getCapacity() > stackBufferSize)
+			UUNIC_COUNT_ALLOCATION(m_utf16->getCapacity() * sizeof(char16_t));
+#endif
+	}
+	return *m_utf16;
+}
+void BaseUtf8String::InvalidateCache()
 {
-	auto pos = m_string->indexOf(c);
-	return (pos >= 0) ? pos : std::string::npos;
+	m_utf16 = nullptr;
+	m_length.store(npos, std::memory_order_relaxed);
+	delete m_breadcrumbs.exchange(nullptr, std::memory_order_relaxed);
 }
-size_t BaseUtf8String::find(Char16 c, size_t startPos) const
+void BaseUtf8String::CopyLength(const BaseUtf8String &other) { m_length.store(other.m_length.load(std::memory_order_relaxed), std::memory_order_relaxed); }
+size_t BaseUtf8String::length() const
 {
-	auto pos = m_string->indexOf(c);
-	return (pos >= 0) ? pos : std::string::npos;
+	auto len = m_length.load(std::memory_order_relaxed);
+	if(len != npos)
+		return len;
+	auto utf8 = view();
+	len = count_code_points(utf8.data(), utf8.size());
+	m_length.store(len, std::memory_order_relaxed);
+	return len;
 }
+const std::vector<uint32_t> *BaseUtf8String::GetBreadcrumbs() const
+{
+	auto utf8 = view();
+	if(utf8.size() < BREADCRUMB_MIN_SIZE || utf8.size() > std::numeric_limits<uint32_t>::max())
+		return nullptr;
+	auto *breadcrumbs = m_breadcrumbs.load(std::memory_order_acquire);
+	if(breadcrumbs)
+		return breadcrumbs;
+	auto newBreadcrumbs = std::make_unique<std::vector<uint32_t>>();
+	newBreadcrumbs->reserve(utf8.size() / BREADCRUMB_INTERVAL + 1);
+	size_t idx = 0;
+	for(size_t i = 0; i < utf8.size(); ++i) {
+		if((static_cast<uint8_t>(utf8[i]) & 0xC0) == 0x80)
+			continue;
+		if((idx % BREADCRUMB_INTERVAL) == 0)
+			newBreadcrumbs->push_back(static_cast<uint32_t>(i));
+		++idx;
+	}
+	m_length.store(idx, std::memory_order_relaxed);
+	UUNIC_COUNT_ALLOCATION(sizeof(std::vector<uint32_t>));
+	UUNIC_COUNT_ALLOCATION(newBreadcrumbs->capacity() * sizeof(uint32_t));
+	// Another thread may have built the index concurrently, in which case we use theirs
+	if(!m_breadcrumbs.compare_exchange_strong(breadcrumbs, newBreadcrumbs.get(), std::memory_order_acq_rel))
+		return breadcrumbs;
+	return newBreadcrumbs.release();
+}
+size_t BaseUtf8String::GetByteOffset(size_t idx) const
+{
+	if(idx == 0)
+		return 0;
+	auto utf8 = view();
+	auto len = length();
+	if(idx >= len)
+		return utf8.size();
+	if(len == utf8.size())
+		return idx; // Pure ASCII
+	auto *breadcrumbs = GetBreadcrumbs();
+	if(!breadcrumbs)
+		return skip_code_points(utf8, 0, idx);
+	auto crumb = idx / BREADCRUMB_INTERVAL;
+	return skip_code_points(utf8, (*breadcrumbs)[crumb], idx - crumb * BREADCRUMB_INTERVAL);
+}
+size_t BaseUtf8String::GetCodePointIndex(size_t offset) const
+{
+	auto utf8 = view();
+	if(offset >= utf8.size())
+		return length();
+	if(length() == utf8.size())
+		return offset; // Pure ASCII
+	auto *breadcrumbs = GetBreadcrumbs();
+	if(!breadcrumbs)
+		return count_code_points(utf8.data(), offset);
+	auto it = std::upper_bound(breadcrumbs->begin(), breadcrumbs->end(), offset) - 1;
+	auto crumb = static_cast<size_t>(it - breadcrumbs->begin());
+	return crumb * BREADCRUMB_INTERVAL + count_code_points(utf8.data() + *it, offset - *it);
+}
+std::pair<size_t, size_t> BaseUtf8String::GetByteRange(size_t start, size_t count) const
+{
+	auto size = view().size();
+	auto len = length();
+	if(start >= len)
+		return {size, size};
+	auto offset = GetByteOffset(start);
+	if(count >= len - start)
+		return {offset, size};
+	return {offset, GetByteOffset(start + count)};
+}
+size_t BaseUtf8String::Find(std::string_view utf8, size_t startPos) const
+{
+	auto pos = detail::find_bytes(view(), utf8, GetByteOffset(startPos));
+	return (pos != std::string_view::npos) ? GetCodePointIndex(pos) : npos;
+}
+size_t BaseUtf8String::RFind(std::string_view utf8, size_t startPos) const
+{
+	auto pos = view().rfind(utf8, GetByteOffset(startPos));
+	return (pos != std::string_view::npos) ? GetCodePointIndex(pos) : npos;
+}
+size_t BaseUtf8String::FindFirstOf(std::string_view utf8Chars, size_t startPos) const
+{
+	auto utf8 = view();
+	auto offset = GetByteOffset(startPos);
+	if(std::all_of(utf8Chars.begin(), utf8Chars.end(), [](char c) { return static_cast<uint8_t>(c) < 0x80; })) {
+		// ASCII-only set: ASCII bytes are always complete code points, so the bytes can be tested directly
+		std::array<bool, 128> isInSet {};
+		for(auto c : utf8Chars)
+			isInSet[c] = true;
+		for(; offset < utf8.size(); ++offset) {
+			auto c = static_cast<uint8_t>(utf8[offset]);
+			if(c < 0x80 && isInSet[c])
+				return GetCodePointIndex(offset);
+		}
+		return npos;
+	}
+	std::vector<Char32> chars;
+	for(auto it = UnicodeStringIterator {utf8Chars.data(), 0}; it.m_offset < utf8Chars.size(); ++it)
+		chars.push_back(*it);
+	std::sort(chars.begin(), chars.end());
+	for(auto it = UnicodeStringIterator {utf8.data(), offset}; it.m_offset < utf8.size(); ++it) {
+		if(std::binary_search(chars.begin(), chars.end(), *it))
+			return GetCodePointIndex(it.m_offset);
+	}
+	return npos;
+}
+std::vector<size_t> BaseUtf8String::FindAll(std::string_view utf8, size_t startPos) const
+{
+	std::vector<size_t> positions;
+	if(utf8.empty())
+		return positions;
+	auto str = view();
+	auto offset = GetByteOffset(startPos);
+	auto idx = GetCodePointIndex(offset);
+	// Code points are counted incrementally between matches instead of translating every match separately
+	auto prevOffset = offset;
+	for(;;) {
+		auto pos = detail::find_bytes(str, utf8, offset);
+		if(pos == std::string_view::npos)
+			break;
+		idx += count_code_points(str.data() + prevOffset, pos - prevOffset);
+		positions.push_back(idx);
+		prevOffset = pos;
+		offset = pos + utf8.size();
+	}
+	return positions;
+}
+size_t BaseUtf8String::size() const { return length(); }
+
+size_t BaseUtf8String::find(Char8 c, size_t startPos) const { return find(static_cast<Char32>(static_cast<uint8_t>(c)), startPos); }
+size_t BaseUtf8String::find(Char16 c, size_t startPos) const { return find(static_cast<Char32>(c), startPos); }
 size_t BaseUtf8String::find(Char32 c, size_t startPos) const
 {
-	auto pos = m_string->indexOf(c);
-	return (pos >= 0) ? pos : std::string::npos;
+	if(c < 0 || c > 0x10FFFF || U_IS_SURROGATE(c))
+		return npos;
+	std::string encoded;
+	append_code_point(encoded, c);
+	return Find(encoded, startPos);
 }
 size_t BaseUtf8String::find(const char *str, size_t startPos) const
 {
-	auto pos = m_string->indexOf(str);
-	return (pos >= 0) ? pos : std::string::npos;
-}
-size_t BaseUtf8String::find(const std::string &str, size_t startPos) const { return find(str.data(), startPos); }
-size_t BaseUtf8String::find(const BaseUtf8String &strU8, size_t startPos) const { return m_string->indexOf(*strU8.m_string, startPos); }
-Char32 BaseUtf8String::at(size_t idx) const { return m_string->char32At(idx); }
-Char32 BaseUtf8String::front() const { return m_string->char32At(0); }
-Char32 BaseUtf8String::back() const { return m_string->char32At(m_string->length() - 1); }
-void BaseUtf8String::toUpper() { m_string->toUpper(); }
-void BaseUtf8String::toLower() { m_string->toLower(); }
-UnicodeStringIterator BaseUtf8String::begin() const { return *this; }
+	std::string buffer;
+	return Find(sanitize_utf8(str, buffer), startPos);
+}
+size_t BaseUtf8String::find(const std::string &str, size_t startPos) const
+{
+	std::string buffer;
+	return Find(sanitize_utf8(str, buffer), startPos);
+}
+size_t BaseUtf8String::find(const BaseUtf8String &strU8, size_t startPos) const { return Find(strU8.view(), startPos); }
+size_t BaseUtf8String::rfind(Char32 c, size_t startPos) const
+{
+	if(c < 0 || c > 0x10FFFF || U_IS_SURROGATE(c))
+		return npos;
+	std::string encoded;
+	append_code_point(encoded, c);
+	return RFind(encoded, startPos);
+}
+size_t BaseUtf8String::rfind(const char *str, size_t startPos) const
+{
+	std::string buffer;
+	return RFind(sanitize_utf8(str, buffer), startPos);
+}
+size_t BaseUtf8String::rfind(const std::string &str, size_t startPos) const
+{
+	std::string buffer;
+	return RFind(sanitize_utf8(str, buffer), startPos);
+}
+size_t BaseUtf8String::rfind(const BaseUtf8String &str, size_t startPos) const { return RFind(str.view(), startPos); }
+size_t BaseUtf8String::find_first_of(const char *chars, size_t startPos) const
+{
+	std::string buffer;
+	return FindFirstOf(sanitize_utf8(chars, buffer), startPos);
+}
+size_t BaseUtf8String::find_first_of(const std::string &chars, size_t startPos) const
+{
+	std::string buffer;
+	return FindFirstOf(sanitize_utf8(chars, buffer), startPos);
+}
+size_t BaseUtf8String::find_first_of(const BaseUtf8String &chars, size_t startPos) const { return FindFirstOf(chars.view(), startPos); }
+std::vector<size_t> BaseUtf8String::find_all(const char *str, size_t startPos) const
+{
+	std::string buffer;
+	return FindAll(sanitize_utf8(str, buffer), startPos);
+}
+std::vector<size_t> BaseUtf8String::find_all(const std::string &str, size_t startPos) const
+{
+	std::string buffer;
+	return FindAll(sanitize_utf8(str, buffer), startPos);
+}
+std::vector<size_t> BaseUtf8String::find_all(const BaseUtf8String &str, size_t startPos) const { return FindAll(str.view(), startPos); }
+Char32 BaseUtf8String::at(size_t idx) const { return decode_at(view(), GetByteOffset(idx)); }
+Char32 BaseUtf8String::front() const { return decode_at(view(), 0); }
+Char32 BaseUtf8String::back() const
+{
+	auto utf8 = view();
+	if(utf8.empty())
+		return INVALID_CHAR;
+	auto offset = utf8.size() - 1;
+	while(offset > 0 && (static_cast<uint8_t>(utf8[offset]) & 0xC0) == 0x80)
+		--offset;
+	return decode_at(utf8, offset);
+}
+UnicodeStringIterator BaseUtf8String::begin() const { return {view().data(), 0}; }
 UnicodeStringIterator BaseUtf8String::end() const
 {
-	UnicodeStringIterator it {*this};
-	it.done = true;
-	return it;
+	auto utf8 = view();
+	return {utf8.data(), utf8.size()};
 }
 std::string BaseUtf8String::cpp_str() const
 {
-	std::string utf8String;
-	m_string->toUTF8String(utf8String);
-	return utf8String;
+	std::string str {view()};
+	UUNIC_COUNT_STRING_ALLOCATION(str);
+	return str;
+}
+const char16_t *BaseUtf8String::data()
+{
+	GetIcuString();
+	return m_utf16->getTerminatedBuffer();
 }
-const char16_t *BaseUtf8String::data() { return m_string->getTerminatedBuffer(); }
 const char16_t *BaseUtf8String::c_str() { return data(); }
 BaseUtf8String::operator std::string() const { return cpp_str(); }
-bool BaseUtf8String::operator==(const BaseUtf8String &other) const { return *m_string == *other.m_string; }
+bool BaseUtf8String::operator==(const BaseUtf8String &other) const { return view() == other.view(); }
 bool BaseUtf8String::operator!=(const BaseUtf8String &other) const { return !operator==(other); }
-bool BaseUtf8String::operator==(const std::string &other) const { return operator==(Utf8String {other}); }
+bool BaseUtf8String::operator==(const std::string &other) const { return view() == other; }
 bool BaseUtf8String::operator!=(const std::string &other) const { return !operator==(other); }
-bool BaseUtf8String::operator<(const BaseUtf8String &other) const { return m_string < other.m_string; }
-bool BaseUtf8String::operator>(const BaseUtf8String &other) const { return m_string > other.m_string; }
+std::strong_ordering BaseUtf8String::operator<=>(const BaseUtf8String &other) const { return view() <=> other.view(); }
+std::strong_ordering BaseUtf8String::operator<=>(const std::string &other) const { return view() <=> std::string_view {other}; }
 
 ////////////////////
 
 Utf8String::Utf8String() : BaseUtf8String {} {}
 Utf8String::Utf8String(Char16 c) : Utf8String {} { *this += c; }
 Utf8String::Utf8String(Char32 c) : Utf8String {} { *this += c; }
-Utf8String::Utf8String(const Utf8String &str) : BaseUtf8String {std::make_unique<icu::UnicodeString>(*str.m_string)} {}
-Utf8String::Utf8String(const Utf8StringView &str) : BaseUtf8String {std::make_unique<icu::UnicodeString>(*str.m_string)} {}
-Utf8String::Utf8String(const std::string &str) : BaseUtf8String {std::make_unique<icu::UnicodeString>(icu::UnicodeString::fromUTF8(str))} {}
-Utf8String::Utf8String(const char *str) : BaseUtf8String {std::make_unique<icu::UnicodeString>(icu::UnicodeString::fromUTF8(icu::StringPiece {str}))} {}
-Utf8String::Utf8String(const char *str, size_t count) : BaseUtf8String {std::make_unique<icu::UnicodeString>(icu::UnicodeString::fromUTF8(icu::StringPiece {str, static_cast<int32_t>(count)}))} {}
-Utf8String::Utf8String(const char16_t *str) : BaseUtf8String {std::make_unique<icu::UnicodeString>(str)} {}
-Utf8String::Utf8String(const char16_t *str, size_t count) : BaseUtf8String {std::make_unique<icu::UnicodeString>(str, count)} {}
-Utf8String::Utf8String(const int32_t *str, size_t count) : BaseUtf8String {std::make_unique<icu::UnicodeString>(icu::UnicodeString::fromUTF32(str, count))} {}
+Utf8String::Utf8String(const Utf8String &str) : BaseUtf8String {}, m_utf8 {str.m_utf8}
+{
+	CopyLength(str);
+	UUNIC_COUNT_STRING_ALLOCATION(m_utf8);
+}
+Utf8String::Utf8String(Utf8String &&str) noexcept : BaseUtf8String {std::move(str)}, m_utf8 {std::move(str.m_utf8)} { str.m_utf8.clear(); }
+Utf8String::Utf8String(const Utf8StringView &str) : BaseUtf8String {}, m_utf8 {str.view()}
+{
+	CopyLength(str);
+	UUNIC_COUNT_STRING_ALLOCATION(m_utf8);
+}
+Utf8String::Utf8String(const std::string &str) : BaseUtf8String {}, m_utf8 {utf8_from(str)} {}
+Utf8String::Utf8String(std::string &&str) : BaseUtf8String {}, m_utf8 {adopt_utf8(std::move(str))} {}
+Utf8String::Utf8String(const char *str) : BaseUtf8String {}, m_utf8 {utf8_from(str)} {}
+Utf8String::Utf8String(const char *str, size_t count) : BaseUtf8String {}, m_utf8 {utf8_from({str, count})} {}
+Utf8String::Utf8String(const char16_t *str) : BaseUtf8String {} { append_utf16(m_utf8, str); }
+Utf8String::Utf8String(const char16_t *str, size_t count) : BaseUtf8String {} { append_utf16(m_utf8, {str, count}); }
+Utf8String::Utf8String(const int32_t *str, size_t count) : BaseUtf8String {}
+{
+	m_utf8.reserve(count);
+	for(size_t i = 0; i < count; ++i)
+		append_code_point(m_utf8, str[i]);
+	UUNIC_COUNT_STRING_ALLOCATION(m_utf8);
+}
 Utf8String &Utf8String::operator=(const Utf8String &str)
 {
-	m_string = std::make_unique<icu::UnicodeString>(*str.m_string);
+	if(&str == this)
+		return *this;
+	UUNIC_COUNT_STRING_GROWTH(m_utf8);
+	m_utf8 = str.m_utf8;
+	InvalidateCache();
+	CopyLength(str);
+	return *this;
+}
+Utf8String &Utf8String::operator=(Utf8String &&str) noexcept
+{
+	if(&str == this)
+		return *this;
+	BaseUtf8String::operator=(std::move(str));
+	m_utf8 = std::move(str.m_utf8);
+	str.m_utf8.clear();
 	return *this;
 }
 Utf8String &Utf8String::operator=(const Utf8StringView &str)
 {
-	m_string = std::make_unique<icu::UnicodeString>(*str.m_string);
+	// The view may refer to this string
+	m_utf8.assign(str.view());
+	InvalidateCache();
+	CopyLength(str);
 	return *this;
 }
 Utf8String &Utf8String::operator=(const std::string &str)
 {
-	m_string = std::make_unique<icu::UnicodeString>(icu::UnicodeString::fromUTF8(icu::StringPiece {str}));
+	m_utf8 = utf8_from(str);
+	InvalidateCache();
+	return *this;
+}
+Utf8String &Utf8String::operator=(std::string &&str)
+{
+	m_utf8 = adopt_utf8(std::move(str));
+	InvalidateCache();
 	return *this;
 }
 Utf8String &Utf8String::operator=(const char *str)
 {
-	m_string = std::make_unique<icu::UnicodeString>(icu::UnicodeString::fromUTF8(icu::StringPiece {str}));
+	m_utf8 = utf8_from(str);
+	InvalidateCache();
 	return *this;
 }
 Utf8String &Utf8String::operator=(const char16_t *str)
 {
-	m_string = std::make_unique<icu::UnicodeString>(str);
+	m_utf8.clear();
+	append_utf16(m_utf8, str);
+	InvalidateCache();
 	return *this;
 }
 
+Utf8String Utf8String::CopyWithCapacity(size_t extraBytes) const
+{
+	Utf8String cpy {};
+	cpy.m_utf8.reserve(m_utf8.size() + extraBytes);
+	cpy.m_utf8 = m_utf8;
+	cpy.CopyLength(*this);
+	UUNIC_COUNT_STRING_ALLOCATION(cpy.m_utf8);
+	return cpy;
+}
 Utf8String Utf8String::operator+(const Utf8String &str) const
 {
-	auto cpy = *this;
+	auto cpy = CopyWithCapacity(str.m_utf8.size());
 	cpy.operator+=(str);
 	return cpy;
 }
 Utf8String Utf8String::operator+(const Utf8StringView &str) const
 {
-	auto cpy = *this;
+	auto cpy = CopyWithCapacity(str.m_size);
 	cpy.operator+=(str);
 	return cpy;
 }
 Utf8String Utf8String::operator+(const std::string &str) const
 {
-	auto cpy = *this;
+	auto cpy = CopyWithCapacity(str.size());
 	cpy.operator+=(str);
 	return cpy;
 }
 Utf8String Utf8String::operator+(const char *str) const
 {
-	auto cpy = *this;
+	auto cpy = CopyWithCapacity(std::char_traits<char>::length(str));
 	cpy.operator+=(str);
 	return cpy;
 }
 Utf8String Utf8String::operator+(const char16_t *str) const
 {
-	auto cpy = *this;
+	auto cpy = CopyWithCapacity(std::char_traits<char16_t>::length(str));
 	cpy.operator+=(str);
 	return cpy;
 }
 Utf8String Utf8String::operator+(Char8 c) const
 {
-	auto cpy = *this;
+	auto cpy = CopyWithCapacity(2);
 	cpy.operator+=(c);
 	return cpy;
 }
 Utf8String Utf8String::operator+(Char16 c) const
 {
-	auto cpy = *this;
+	auto cpy = CopyWithCapacity(3);
 	cpy.operator+=(c);
 	return cpy;
 }
 Utf8String Utf8String::operator+(Char32 c) const
 {
-	auto cpy = *this;
+	auto cpy = CopyWithCapacity(U8_MAX_LENGTH);
 	cpy.operator+=(c);
 	return cpy;
 }
 
 Utf8String &Utf8String::operator+=(const Utf8String &str)
 {
-	*m_string += *str.m_string;
+	UUNIC_COUNT_STRING_GROWTH(m_utf8);
+	m_utf8 += str.m_utf8;
+	InvalidateCache();
 	return *this;
 }
 Utf8String &Utf8String::operator+=(const Utf8StringView &str)
 {
-	*m_string += *str.m_string;
+	UUNIC_COUNT_STRING_GROWTH(m_utf8);
+	m_utf8 += str.view();
+	InvalidateCache();
 	return *this;
 }
-Utf8String &Utf8String::operator+=(const std::string &str) { return operator+=(Utf8String {str}); }
-Utf8String &Utf8String::operator+=(const char *str) { return operator+=(Utf8String {str}); }
-Utf8String &Utf8String::operator+=(const char16_t *str) { return operator+=(Utf8String {str}); }
-Utf8String &Utf8String::operator+=(Char8 c)
+Utf8String &Utf8String::operator+=(const std::string &str)
 {
-	*m_string += c;
+	append_utf8(m_utf8, str);
+	InvalidateCache();
 	return *this;
 }
-Utf8String &Utf8String::operator+=(Char16 c)
+Utf8String &Utf8String::operator+=(const char *str)
 {
-	*m_string += c;
+	append_utf8(m_utf8, str);
+	InvalidateCache();
 	return *this;
 }
+Utf8String &Utf8String::operator+=(const char16_t *str)
+{
+	append_utf16(m_utf8, str);
+	InvalidateCache();
+	return *this;
+}
+Utf8String &Utf8String::operator+=(Char8 c) { return operator+=(static_cast<Char32>(static_cast<uint8_t>(c))); }
+Utf8String &Utf8String::operator+=(Char16 c) { return operator+=(static_cast<Char32>(c)); }
 Utf8String &Utf8String::operator+=(Char32 c)
 {
-	*m_string += c;
+	UUNIC_COUNT_STRING_GROWTH(m_utf8);
+	append_code_point(m_utf8, c);
+	InvalidateCache();
 	return *this;
 }
+void Utf8String::ReplaceBytes(size_t offset, size_t endOffset, std::string_view utf8)
+{
+	// Keep the length up to date, so that repeated replacements don't have to recount the whole string
+	auto len = m_length.load(std::memory_order_relaxed);
+	if(len != npos)
+		len = len - count_code_points(m_utf8.data() + offset, endOffset - offset) + count_code_points(utf8.data(), utf8.size());
+	UUNIC_COUNT_STRING_GROWTH(m_utf8);
+	m_utf8.replace(offset, endOffset - offset, utf8);
+	InvalidateCache();
+	m_length.store(len, std::memory_order_relaxed);
+}
 Utf8String &Utf8String::replace(int32_t start, int32_t len, const Utf8StringArg &str)
 {
-	m_string->replace(start, len, str->GetIcuString());
+	auto [offset, endOffset] = GetByteRange(std::max(start, 0), std::max(len, 0));
+	ReplaceBytes(offset, endOffset, str->view());
 	return *this;
 }
 UnicodeStringIterator Utf8String::erase(const UnicodeStringIterator &it, size_t count)
 {
-	auto idx = it.iterator->getIndex();
-	m_string->removeBetween(idx, idx + count);
-
-	UnicodeStringIterator newIt {};
-	if(m_string->isEmpty()) {
-		newIt.iterator = std::make_unique<icu::StringCharacterIterator>(*m_string);
-		newIt.done = true;
-	}
-	else
-		newIt.iterator = std::make_unique<icu::StringCharacterIterator>(*m_string, idx);
-	return newIt;
+	auto offset = std::min(it.m_offset, m_utf8.size());
+	m_utf8.erase(offset, skip_code_points(m_utf8, offset, count) - offset);
+	InvalidateCache();
+	return {m_utf8.data(), offset};
 }
 UnicodeStringIterator Utf8String::erase(const UnicodeStringIterator &it, const UnicodeStringIterator &itEnd)
 {
-	auto idx0 = it.iterator->getIndex();
-	auto idx1 = itEnd.iterator->getIndex();
-	if(idx1 <= idx0)
+	if(itEnd.m_offset <= it.m_offset)
 		return it;
-	return erase(it, idx1 - idx0);
+	auto offset = std::min(it.m_offset, m_utf8.size());
+	m_utf8.erase(offset, std::min(itEnd.m_offset, m_utf8.size()) - offset);
+	InvalidateCache();
+	return {m_utf8.data(), offset};
+}
+void Utf8String::insert(const UnicodeStringIterator &it, const Utf8StringArg &str)
+{
+	auto offset = std::min(it.m_offset, m_utf8.size());
+	ReplaceBytes(offset, offset, str->view());
 }
-void Utf8String::insert(const UnicodeStringIterator &it, const Utf8StringArg &str) { m_string->insert(it.iterator->getIndex(), str->GetIcuString()); }
 Utf8String Utf8String::substr(size_t start, size_t count) const
 {
-	if(count > INT32_MAX)
-		count = INT32_MAX;
-	auto sub = m_string->tempSubString(start, count);
-	return Utf8String {sub.getTerminatedBuffer()};
+	auto [offset, endOffset] = GetByteRange(start, count);
+	// The range is already well-formed UTF-8, so it can be copied into the result directly
+	Utf8String sub {};
+	sub.m_utf8.assign(m_utf8, offset, endOffset - offset);
+	UUNIC_COUNT_STRING_ALLOCATION(sub.m_utf8);
+	return sub;
+}
+void Utf8String::clear()
+{
+	m_utf8.clear();
+	InvalidateCache();
+}
+void Utf8String::toUpper()
+{
+	map_case(m_utf8, true);
+	InvalidateCache();
+}
+void Utf8String::toLower()
+{
+	map_case(m_utf8, false);
+	InvalidateCache();
 }
-void Utf8String::clear() { m_string->remove(); }
 
 ////////////////////
 
 Utf8StringView::Utf8StringView() : BaseUtf8String {} {}
-Utf8StringView::Utf8StringView(const Utf8String &str) : BaseUtf8String {} { operator=(str); }
-Utf8StringView::Utf8StringView(const Utf8StringView &str) : BaseUtf8String {} { operator=(str); }
+Utf8StringView::Utf8StringView(const Utf8String &str) : BaseUtf8String {}, m_data {str.m_utf8.data()}, m_size {str.m_utf8.size()} { CopyLength(str); }
+Utf8StringView::Utf8StringView(const Utf8StringView &str) : BaseUtf8String {}, m_data {str.m_data}, m_size {str.m_size} { CopyLength(str); }
+Utf8StringView::Utf8StringView(Utf8StringView &&str) noexcept : BaseUtf8String {std::move(str)}, m_data {str.m_data}, m_size {str.m_size}
+{
+	str.m_data = nullptr;
+	str.m_size = 0;
+}
+Utf8StringView::Utf8StringView(std::string_view utf8) : BaseUtf8String {}, m_data {utf8.data()}, m_size {utf8.size()}
+{
+	auto invalid = find_invalid_utf8(utf8);
+	if(invalid != utf8.size())
+		throw std::runtime_error {"Ill-formed UTF-8 sequence at byte offset " + std::to_string(invalid) + "!"};
+}
 Utf8StringView::~Utf8StringView() {}
 Utf8StringView &Utf8StringView::operator=(const Utf8String &str)
 {
-	m_string->fastCopyFrom(*str.m_string);
-	m_underlyingString = str.m_string.get();
-	m_start = 0;
-	m_length = str.length();
+	InvalidateCache();
+	CopyLength(str);
+	m_data = str.m_utf8.data();
+	m_size = str.m_utf8.size();
 	return *this;
 }
 Utf8StringView &Utf8StringView::operator=(const Utf8StringView &str)
 {
-	m_underlyingString = str.m_underlyingString;
-	m_start = str.m_start;
-	m_length = str.m_length;
-	if(m_underlyingString)
-		m_string->fastCopyFrom(m_underlyingString->tempSubString(m_start, m_length));
-	else
-		m_string = std::make_unique<icu::UnicodeString>();
+	if(&str == this)
+		return *this;
+	InvalidateCache();
+	CopyLength(str);
+	m_data = str.m_data;
+	m_size = str.m_size;
+	return *this;
+}
+Utf8StringView &Utf8StringView::operator=(Utf8StringView &&str) noexcept
+{
+	if(&str == this)
+		return *this;
+	BaseUtf8String::operator=(std::move(str));
+	m_data = str.m_data;
+	m_size = str.m_size;
+	str.m_data = nullptr;
+	str.m_size = 0;
 	return *this;
 }
 Utf8StringView Utf8StringView::substr(size_t start, size_t count) const
 {
-	if(count > INT32_MAX)
-		count = INT32_MAX;
+	auto [offset, endOffset] = GetByteRange(start, count);
 	Utf8StringView sub {};
-	sub.m_underlyingString = m_underlyingString;
-	sub.m_start = m_start + start;
-	sub.m_length = std::min(m_start + m_length, m_start + start + count) - sub.m_start;
-	if(m_underlyingString)
-		sub.m_string->fastCopyFrom(m_underlyingString->tempSubString(sub.m_start, sub.m_length));
-	else
-		sub.m_string = std::make_unique<icu::UnicodeString>();
+	sub.m_data = m_data + offset;
+	sub.m_size = endOffset - offset;
+	if(length() == m_size)
+		sub.m_length.store(sub.m_size, std::memory_order_relaxed); // Pure ASCII
 	return sub;
 }
 Utf8String Utf8StringView::to_str() const { return {*this}; }
 
 ////////////////////
 
-UnicodeStringIterator::UnicodeStringIterator() : iterator {}, done {false} {}
-UnicodeStringIterator::UnicodeStringIterator(const BaseUtf8String &str) : iterator {std::make_unique<icu::StringCharacterIterator>(str.GetIcuString())}, done {str.empty()} {}
-UnicodeStringIterator::UnicodeStringIterator(const UnicodeStringIterator &it) : iterator {std::make_unique<icu::StringCharacterIterator>(*it.iterator)}, done {it.done} {}
+UnicodeStringIterator::UnicodeStringIterator(const BaseUtf8String &str) : m_data {str.view().data()}, m_offset {0} {}
 
-UnicodeStringIterator::~UnicodeStringIterator() {}
+////////////////////
 
-bool UnicodeStringIterator::operator<(const UnicodeStringIterator &other) const { return iterator->current32() < other.iterator->current32(); }
-bool UnicodeStringIterator::operator>(const UnicodeStringIterator &other) const { return iterator->current32() > other.iterator->current32(); }
-bool UnicodeStringIterator::operator==(const UnicodeStringIterator &other) const
+Utf8StringArg::Utf8StringArg(std::string_view text)
 {
-	if(done && other.done)
-		return true;
-	if(done != other.done || (!iterator && other.iterator) || (iterator && !other.iterator))
-		return false;
-	if(!iterator && !other.iterator)
-		return true;
-	return *iterator == *other.iterator;
+	if(find_invalid_utf8(text) == text.size()) {
+		m_view.m_data = text.data();
+		m_view.m_size = text.size();
+		return;
+	}
+	m_cpy = std::make_unique<Utf8String>(text.data(), text.size());
+	UUNIC_COUNT_ALLOCATION(sizeof(Utf8String));
+	m_view = *m_cpy;
 }
-bool UnicodeStringIterator::operator!=(const UnicodeStringIterator &other) const { return !operator==(other); }
+Utf8StringArg::Utf8StringArg(const char *text) : Utf8StringArg {std::string_view {text}} {}
+Utf8StringArg::Utf8StringArg(const std::string &text) : Utf8StringArg {std::string_view {text}} {}
+Utf8StringArg::Utf8StringArg(const Utf8String &text) : m_view {text} {}
+Utf8StringArg::Utf8StringArg(const Utf8StringView &text) : m_view {text} {}
+Utf8StringArg::~Utf8StringArg() {}
+const Utf8StringView &Utf8StringArg::operator*() const { return m_view; }
+const Utf8StringView *Utf8StringArg::operator->() const { return &m_view; }
 
-Char32 UnicodeStringIterator::operator*() const { return iterator->current32(); }
+////////////////////
 
-UnicodeStringIterator &UnicodeStringIterator::operator++()
+Utf8StringBuilder::Utf8StringBuilder(size_t capacity)
 {
-	auto c = iterator->next32();
-	if(c == icu::CharacterIterator::DONE)
-		done = true;
+	m_buffer.reserve(capacity);
+	UUNIC_COUNT_STRING_ALLOCATION(m_buffer);
+}
+Utf8StringBuilder &Utf8StringBuilder::Append(std::string_view utf8)
+{
+	append_utf8(m_buffer, utf8);
 	return *this;
 }
-
-UnicodeStringIterator &UnicodeStringIterator::operator--()
+Utf8StringBuilder &Utf8StringBuilder::Append(std::u16string_view utf16)
 {
-	auto c = iterator->previous32();
-	if(c == icu::CharacterIterator::DONE)
-		done = true;
+	append_utf16(m_buffer, utf16);
 	return *this;
 }
-
-UnicodeStringIterator UnicodeStringIterator::operator+(int32_t idx) const
+Utf8StringBuilder &Utf8StringBuilder::Append(const BaseUtf8String &str)
 {
-	auto newIt = *this;
-	newIt += idx;
-	return newIt;
+	UUNIC_COUNT_STRING_GROWTH(m_buffer);
+	m_buffer += str.view();
+	return *this;
 }
-
-UnicodeStringIterator &UnicodeStringIterator::operator+=(int32_t idx)
+Utf8StringBuilder &Utf8StringBuilder::AppendCodePoint(Char32 c)
 {
-	if(idx > 0) {
-		for(int32_t i = 0; i < idx; ++i)
-			operator++();
-		return *this;
-	}
-	for(int32_t i = 0; i < idx; ++i)
-		operator--();
+	UUNIC_COUNT_STRING_GROWTH(m_buffer);
+	append_code_point(m_buffer, c);
 	return *this;
 }
+std::back_insert_iterator<std::string> Utf8StringBuilder::GetBackInserter()
+{
+	m_requiresValidation = true;
+	return std::back_inserter(m_buffer);
+}
+void Utf8StringBuilder::Clear()
+{
+	m_buffer.clear();
+	m_requiresValidation = false;
+}
+Utf8String Utf8StringBuilder::Finish()
+{
+	Utf8String str {};
+	if(m_requiresValidation)
+		str.m_utf8 = adopt_utf8(std::move(m_buffer));
+	else
+		str.m_utf8 = std::move(m_buffer);
+	m_buffer = {};
+	m_requiresValidation = false;
+	return str;
+}
 
-UnicodeStringIterator &UnicodeStringIterator::operator=(const UnicodeStringIterator &other)
+//////////////////////////
+
+int pragma::string::icompare(const BaseUtf8String &a, const BaseUtf8String &b)
 {
-	iterator = std::make_unique<icu_78::StringCharacterIterator>(*other.iterator);
-	done = other.done;
-	return *this;
+	auto strA = a.view();
+	auto strB = b.view();
+	size_t offsetA = 0;
+	size_t offsetB = 0;
+	while(offsetA < strA.size() && offsetB < strB.size()) {
+		auto ca = fold_case(next_code_point(strA, offsetA));
+		auto cb = fold_case(next_code_point(strB, offsetB));
+		if(ca != cb)
+			return (ca < cb) ? -1 : 1;
+	}
+	if(offsetA < strA.size())
+		return 1;
+	if(offsetB < strB.size())
+		return -1;
+	return 0;
+}
+bool pragma::string::iequals(const BaseUtf8String &a, const BaseUtf8String &b) { return icompare(a, b) == 0; }
+size_t pragma::string::ihash(const BaseUtf8String &str)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	auto utf8 = str.view();
+	for(size_t offset = 0; offset < utf8.size();) {
+		auto c = static_cast<uint32_t>(fold_case(next_code_point(utf8, offset)));
+		for(auto i = 0; i < 4; ++i) {
+			hash ^= (c >> (i * 8)) & 0xFF;
+			hash *= 1099511628211ull;
+		}
+	}
+	return static_cast<size_t>(hash);
 }
 
-////////////////////
+//////////////////////////
 
-Utf8StringArg::Utf8StringArg(const char *text) : m_cpy {std::make_unique<Utf8String>(text)}, m_view {*m_cpy} {}
-Utf8StringArg::Utf8StringArg(const std::string &text) : m_cpy {std::make_unique<Utf8String>(text)}, m_view {*m_cpy} {}
-Utf8StringArg::Utf8StringArg(const Utf8String &text) : m_cpy {std::make_unique<Utf8String>(text)}, m_view {*m_cpy} {}
-Utf8StringArg::Utf8StringArg(const Utf8StringView &text) : m_view {text} {}
-Utf8StringArg::~Utf8StringArg() {}
-const Utf8StringView &Utf8StringArg::operator*() const { return m_view; }
-const Utf8StringView *Utf8StringArg::operator->() const { return &m_view; }
+// Hashes a byte stream in 8-byte words, so that data that arrives in pieces (e.g. UTF-8 that is
+// transcoded on the fly) results in the same hash as contiguous data
+class Utf8Hasher {
+  public:
+	void Append(const char *data, size_t size)
+	{
+		m_size += size;
+		if(m_pendingSize > 0) {
+			auto n = std::min(size, sizeof(m_pending) - m_pendingSize);
+			std::memcpy(m_pending + m_pendingSize, data, n);
+			m_pendingSize += n;
+			data += n;
+			size -= n;
+			if(m_pendingSize < sizeof(m_pending))
+				return;
+			Mix(m_pending);
+			m_pendingSize = 0;
+		}
+		for(; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t))
+			Mix(data);
+		std::memcpy(m_pending, data, size);
+		m_pendingSize = size;
+	}
+	size_t Finish()
+	{
+		if(m_pendingSize > 0) {
+			std::memset(m_pending + m_pendingSize, 0, sizeof(m_pending) - m_pendingSize);
+			Mix(m_pending);
+		}
+		auto hash = m_hash ^ m_size;
+		hash ^= hash >> 33;
+		hash *= 0xFF51AFD7ED558CCDull;
+		hash ^= hash >> 33;
+		return static_cast<size_t>(hash);
+	}
+  private:
+	void Mix(const char *data)
+	{
+		uint64_t word;
+		std::memcpy(&word, data, sizeof(word));
+		m_hash = (m_hash ^ word) * 0x9E3779B97F4A7C15ull;
+		m_hash ^= m_hash >> 29;
+	}
+	uint64_t m_hash = 0xCBF29CE484222325ull;
+	uint64_t m_size = 0;
+	char m_pending[sizeof(uint64_t)];
+	size_t m_pendingSize = 0;
+};
+size_t pragma::string::utf8_hash(std::string_view utf8)
+{
+	Utf8Hasher hasher {};
+	hasher.Append(utf8.data(), utf8.size());
+	return hasher.Finish();
+}
+size_t pragma::string::utf8_hash(std::u16string_view utf16)
+{
+	Utf8Hasher hasher {};
+	auto len = static_cast<int32_t>(utf16.size());
+	for(int32_t i = 0; i < len;) {
+		UChar32 c;
+		U16_NEXT(utf16.data(), i, len, c);
+		if(U_IS_SURROGATE(c))
+			c = REPLACEMENT_CHAR;
+		char buf[U8_MAX_LENGTH];
+		int32_t n = 0;
+		U8_APPEND_UNSAFE(buf, n, c);
+		hasher.Append(buf, n);
+	}
+	return hasher.Finish();
+}
+bool pragma::string::utf8_equals(std::string_view utf8, std::u16string_view utf16)
+{
+	size_t offset = 0;
+	auto len = static_cast<int32_t>(utf16.size());
+	int32_t i = 0;
+	while(offset < utf8.size() && i < len) {
+		UChar32 c;
+		U16_NEXT(utf16.data(), i, len, c);
+		if(U_IS_SURROGATE(c))
+			c = REPLACEMENT_CHAR;
+		if(next_code_point(utf8, offset) != c)
+			return false;
+	}
+	return offset == utf8.size() && i == len;
+}
 
 //////////////////////////
 
 std::ostream &pragma::string::operator<<(std::ostream &out, const Utf8String &str)
 {
-	out << str.cpp_str();
+	out << str.view();
 	return out;
 }
 std::ostream &pragma::string::operator<<(std::ostream &out, const Utf8StringView &str)
 {
-	out << str.cpp_str();
+	out << str.view();
 	return out;
 }
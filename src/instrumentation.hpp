@@ -0,0 +1,131 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef __UTIL_UNICODE_INSTRUMENTATION_HPP__
+#define __UTIL_UNICODE_INSTRUMENTATION_HPP__
+
+// Counters for allocations, transcodes and Shift_JIS decoding. Only compiled in if UUNIC_ENABLE_INSTRUMENTATION is defined,
+// otherwise the UUNIC_COUNT* and UUNIC_TIME_SCOPE macros expand to nothing.
+#ifdef UUNIC_ENABLE_INSTRUMENTATION
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace pragma::string::detail {
+	enum class Counter : uint8_t {
+		AllocationCount = 0,
+		AllocatedBytes,
+		Utf8ToUtf16Count,
+		Utf16ToUtf8Count,
+		TranscodedBytes,
+		TranscodeTime,
+		ShiftJisDecodedBytes,
+		ShiftJisDecodeTime,
+		Count,
+	};
+	using CounterValues = std::array<uint64_t, static_cast<size_t>(Counter::Count)>;
+
+	// Counters of a single thread. Only the owning thread writes to them, so they can be updated without atomic
+	// read-modify-write operations. They're atomic so that other threads can read them for the totals.
+	struct ThreadCounters {
+		ThreadCounters();
+		~ThreadCounters();
+		std::array<std::atomic<uint64_t>, static_cast<size_t>(Counter::Count)> values {};
+	};
+	// Only locked when threads start or stop counting, and when the totals are queried
+	struct CounterRegistry {
+		std::mutex mutex;
+		std::vector<ThreadCounters *> threads;
+		// Counters of threads that have exited
+		CounterValues retired {};
+	};
+	// Intentionally leaked, so that threads exiting during static destruction can still unregister
+	inline CounterRegistry &get_counter_registry()
+	{
+		static auto *registry = new CounterRegistry {};
+		return *registry;
+	}
+	inline ThreadCounters::ThreadCounters()
+	{
+		auto &registry = get_counter_registry();
+		std::scoped_lock lock {registry.mutex};
+		registry.threads.push_back(this);
+	}
+	inline ThreadCounters::~ThreadCounters()
+	{
+		auto &registry = get_counter_registry();
+		std::scoped_lock lock {registry.mutex};
+		for(size_t i = 0; i < values.size(); ++i)
+			registry.retired[i] += values[i].load(std::memory_order_relaxed);
+		std::erase(registry.threads, this);
+	}
+	inline ThreadCounters &get_thread_counters()
+	{
+		thread_local ThreadCounters counters {};
+		return counters;
+	}
+
+	inline void add_counter(Counter counter, uint64_t value)
+	{
+		auto &v = get_thread_counters().values[static_cast<size_t>(counter)];
+		v.store(v.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+	inline void count_allocation(size_t bytes)
+	{
+		add_counter(Counter::AllocationCount, 1);
+		add_counter(Counter::AllocatedBytes, bytes);
+	}
+	// Counts an allocation if the capacity of str has grown beyond prevCapacity. By default that's the capacity of an
+	// empty string, i.e. the small string buffer, which doesn't require an allocation.
+	inline void count_string_allocation(const std::string &str, size_t prevCapacity = std::string {}.capacity())
+	{
+		if(str.capacity() > prevCapacity)
+			count_allocation(str.capacity() + 1);
+	}
+
+	// Counts an allocation if the capacity of str has grown by the end of the scope. Multiple reallocations
+	// within the scope are counted as one.
+	class ScopedStringAllocationCounter {
+	  public:
+		ScopedStringAllocationCounter(const std::string &str) : m_str {str}, m_capacity {str.capacity()} {}
+		~ScopedStringAllocationCounter() { count_string_allocation(m_str, m_capacity); }
+		ScopedStringAllocationCounter(const ScopedStringAllocationCounter &) = delete;
+		ScopedStringAllocationCounter &operator=(const ScopedStringAllocationCounter &) = delete;
+	  private:
+		const std::string &m_str;
+		size_t m_capacity;
+	};
+
+	// Adds the time until the end of the scope (in nanoseconds) to a counter
+	class ScopedTimer {
+	  public:
+		ScopedTimer(Counter counter) : m_counter {counter}, m_start {std::chrono::steady_clock::now()} {}
+		~ScopedTimer() { add_counter(m_counter, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count()); }
+		ScopedTimer(const ScopedTimer &) = delete;
+		ScopedTimer &operator=(const ScopedTimer &) = delete;
+	  private:
+		Counter m_counter;
+		std::chrono::steady_clock::time_point m_start;
+	};
+};
+
+#define UUNIC_COUNT(counter, value) ::pragma::string::detail::add_counter(::pragma::string::detail::Counter::counter, static_cast<uint64_t>(value))
+#define UUNIC_COUNT_ALLOCATION(bytes) ::pragma::string::detail::count_allocation(bytes)
+#define UUNIC_COUNT_STRING_ALLOCATION(...) ::pragma::string::detail::count_string_allocation(__VA_ARGS__)
+#define UUNIC_SCOPE_NAME_IMPL(name, line) name##line
+#define UUNIC_SCOPE_NAME(name, line) UUNIC_SCOPE_NAME_IMPL(name, line)
+#define UUNIC_COUNT_STRING_GROWTH(str) ::pragma::string::detail::ScopedStringAllocationCounter UUNIC_SCOPE_NAME(uunicStringCounter, __LINE__) {str}
+#define UUNIC_TIME_SCOPE(counter) ::pragma::string::detail::ScopedTimer UUNIC_SCOPE_NAME(uunicScopedTimer, __LINE__) {::pragma::string::detail::Counter::counter}
+#else
+#define UUNIC_COUNT(counter, value)
+#define UUNIC_COUNT_ALLOCATION(bytes)
+#define UUNIC_COUNT_STRING_ALLOCATION(...)
+#define UUNIC_COUNT_STRING_GROWTH(str)
+#define UUNIC_TIME_SCOPE(counter)
+#endif
+
+#endif
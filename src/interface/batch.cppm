@@ -0,0 +1,66 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "definitions.hpp"
+
+export module pragma.string.unicode:batch;
+
+export import std.compat;
+import :utf8;
+import :parallel;
+
+export namespace pragma::string {
+	enum class SourceEncoding : uint8_t {
+		Utf8 = 0,
+		ShiftJis,
+	};
+	struct BatchTranscodeOptions {
+		SourceEncoding encoding = SourceEncoding::Utf8;
+		// If set, the inputs are split into groups which are transcoded concurrently
+		std::optional<ParallelOptions> parallel {};
+	};
+
+	// Immutable list of well-formed UTF-8 strings, which are stored back-to-back in a single buffer
+	class DLLUUNIC Utf8StringTable {
+	  public:
+		Utf8StringTable();
+		Utf8StringTable(const Utf8StringTable &) = delete;
+		Utf8StringTable(Utf8StringTable &&) noexcept;
+		~Utf8StringTable();
+		Utf8StringTable &operator=(const Utf8StringTable &) = delete;
+		Utf8StringTable &operator=(Utf8StringTable &&) noexcept;
+
+		size_t size() const { return m_offsets.size() - 1; }
+		bool empty() const { return size() == 0; }
+		// The returned views refer to the buffer of the table and are valid for as long as the table is
+		Utf8StringView operator[](size_t index) const;
+		// Throws a std::out_of_range if the index is out of range
+		Utf8StringView at(size_t index) const;
+		// All strings, without separators
+		std::string_view GetBuffer() const { return m_buffer; }
+	  private:
+		friend DLLUUNIC Utf8StringTable transcode_batch(std::span<const std::string_view> inputs, const BatchTranscodeOptions &options);
+		friend DLLUUNIC Utf8StringTable transcode_batch(std::span<const std::string> inputs, const BatchTranscodeOptions &options);
+		std::string m_buffer;
+		// Start of every string in the buffer, followed by the size of the buffer
+		std::vector<size_t> m_offsets;
+	};
+
+	// Converts all inputs to UTF-8 at once, with a single allocation for the string data. Ill-formed UTF-8 is
+	// sanitized the same way as by Utf8String, and Shift_JIS is converted like shift_jis_to_utf8.
+	DLLUUNIC Utf8StringTable transcode_batch(std::span<const std::string_view> inputs, const BatchTranscodeOptions &options = {});
+	DLLUUNIC Utf8StringTable transcode_batch(std::span<const std::string> inputs, const BatchTranscodeOptions &options = {});
+};
+
+namespace pragma::string::detail {
+	// Implemented in utf8.cpp
+	bool is_well_formed_utf8(std::string_view utf8);
+	// Implemented in shift_jis.cpp. The output of shift_jis_to_utf8 has to be exactly get_shift_jis_utf8_size(table, input) bytes large.
+	// The table is passed explicitly, so that both use the same one even if init_shift_jis is called in between.
+	struct ShiftJisConversionTable;
+	const ShiftJisConversionTable &get_shift_jis_conversion_table();
+	size_t get_shift_jis_utf8_size(const ShiftJisConversionTable &table, std::string_view input);
+	void shift_jis_to_utf8(const ShiftJisConversionTable &table, std::string_view input, char *output, size_t outputSize);
+};
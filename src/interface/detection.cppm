@@ -0,0 +1,44 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "definitions.hpp"
+
+export module pragma.string.unicode:detection;
+
+export import std.compat;
+import :utf8;
+import :parallel;
+
+export namespace pragma::string {
+	struct Utf8ValidationResult {
+		bool valid = true;
+		// Byte offset of the first ill-formed sequence, or std::string::npos if the data is valid
+		size_t errorOffset = std::string::npos;
+	};
+	// Uses AVX2 if available
+	DLLUUNIC Utf8ValidationResult validate_utf8_buffer(std::string_view data);
+
+	enum class TextEncoding : uint8_t {
+		Unknown = 0,
+		Utf8,
+		Utf16Le,
+		Utf16Be,
+		ShiftJis,
+	};
+	struct EncodingDetectionResult {
+		TextEncoding encoding = TextEncoding::Unknown;
+		// Between 0 and 1. Data with a byte order mark and pure ASCII are always detected with a confidence of 1.
+		float confidence = 0.f;
+		// Size of the byte order mark at the start of the data, if there is one
+		size_t bomSize = 0;
+	};
+	// Checks for a byte order mark, then validates the data as UTF-8 and Shift_JIS, and checks for the zero bytes
+	// of UTF-16 without a byte order mark. The data is only read once.
+	DLLUUNIC EncodingDetectionResult detect_encoding(std::string_view data);
+	// Converts the data to UTF-8 according to detect_encoding, without the byte order mark. Data of unknown
+	// encoding is treated as UTF-8, i.e. ill-formed sequences are replaced with U+FFFD.
+	// Large Shift_JIS inputs are decoded in parallel with the specified options.
+	DLLUUNIC Utf8String decode_auto(std::string_view data, EncodingDetectionResult *outDetection = nullptr, const ParallelOptions &parallelOptions = {});
+};
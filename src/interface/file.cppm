@@ -0,0 +1,50 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "definitions.hpp"
+
+export module pragma.string.unicode:file;
+
+export import std.compat;
+import :utf8;
+import :batch;
+
+export namespace pragma::string {
+	struct FileLoadOptions {
+		// Releases the pages of the file once they have been decoded, so that the file and the decoded string
+		// don't have to be in memory in full at the same time
+		bool releaseDecodedPages = true;
+		// Skips the byte order mark at the start of UTF-8 files
+		bool skipBom = true;
+	};
+	// These memory-map the file and decode it directly into the storage of the returned string, without an
+	// intermediate copy of the file contents. Ill-formed input is replaced with U+FFFD.
+	// Throws a std::runtime_error if the file can't be opened or mapped.
+	DLLUUNIC Utf8String load_utf8_file(const std::string &filePath, const FileLoadOptions &options = {});
+	DLLUUNIC Utf8String load_shift_jis_file(const std::string &filePath, const FileLoadOptions &options = {});
+};
+
+namespace pragma::string::detail {
+	// Read-only memory mapping of an entire file
+	class MappedFile {
+	  public:
+		MappedFile(const std::string &filePath);
+		~MappedFile();
+		MappedFile(const MappedFile &) = delete;
+		MappedFile &operator=(const MappedFile &) = delete;
+		std::string_view GetData() const { return {m_data, m_size}; }
+		Utf8String Decode(SourceEncoding encoding, const FileLoadOptions &options);
+	  private:
+		// Hints the OS that the mapped data before offset won't be accessed again. Only whole pages are released.
+		void ReleaseUntil(size_t offset);
+		const char *m_data = nullptr;
+		size_t m_size = 0;
+		size_t m_releasedSize = 0;
+	};
+
+	// Implemented in shift_jis.cpp. Converts the input in chunks of about chunkSize bytes, directly into the returned string.
+	// onChunkDecoded is called with the end offset of every chunk in the input once that chunk has been converted.
+	std::string shift_jis_to_utf8_chunked(std::string_view input, size_t chunkSize, const std::function<void(size_t)> &onChunkDecoded);
+};
@@ -0,0 +1,37 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "definitions.hpp"
+
+export module pragma.string.unicode:instrumentation;
+
+export import std.compat;
+
+export namespace pragma::string {
+	// Only counted if the library was built with UUNIC_ENABLE_INSTRUMENTATION, otherwise all counters are always 0.
+	// Allocations made internally by ICU are not included.
+	struct DLLUUNIC InstrumentationCounters {
+		// Heap allocations made for string data and caches, and their size
+		uint64_t allocationCount = 0;
+		uint64_t allocatedBytes = 0;
+		uint64_t utf8ToUtf16Count = 0;
+		uint64_t utf16ToUtf8Count = 0;
+		// Size of the transcoded input in bytes
+		uint64_t transcodedBytes = 0;
+		uint64_t transcodeTimeNs = 0;
+		uint64_t shiftJisDecodedBytes = 0;
+		uint64_t shiftJisDecodeTimeNs = 0;
+
+		InstrumentationCounters operator-(const InstrumentationCounters &other) const;
+		InstrumentationCounters &operator+=(const InstrumentationCounters &other);
+	};
+	DLLUUNIC bool is_instrumentation_enabled();
+	// Counters of the calling thread. Doesn't lock.
+	DLLUUNIC InstrumentationCounters get_thread_counters();
+	// Resets the counters of the calling thread, which also removes them from the totals
+	DLLUUNIC void reset_thread_counters();
+	// Sum of the counters of all threads, including threads that have exited
+	DLLUUNIC InstrumentationCounters get_total_counters();
+};
@@ -0,0 +1,104 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "definitions.hpp"
+
+export module pragma.string.unicode:intern;
+
+export import std.compat;
+import :utf8;
+
+export namespace pragma::string {
+	namespace detail {
+		// Stored in the arena of a StringPool, directly followed by the UTF-8 data
+		struct InternedEntry {
+			const Char8 *data;
+			size_t size;
+			size_t hash;
+		};
+		// Key of the entries of a StringPool, so that the hash is only computed once per lookup and is the same as InternedEntry::hash
+		struct HashedKey {
+			std::string_view str;
+			size_t hash;
+			bool operator==(const HashedKey &other) const { return hash == other.hash && str == other.str; }
+		};
+		struct HashedKeyHash {
+			size_t operator()(const HashedKey &key) const { return key.hash; }
+		};
+	};
+
+	class StringPool;
+	// Lightweight handle to a string owned by a StringPool. Handles from the same pool are equal if and
+	// only if the strings are equal. A handle is invalidated when its pool is cleared or destroyed.
+	class DLLUUNIC InternedString {
+	  public:
+		friend StringPool;
+		InternedString() = default;
+		bool operator==(const InternedString &other) const { return m_entry == other.m_entry; }
+		bool operator!=(const InternedString &other) const { return m_entry != other.m_entry; }
+		// Returns false for default-constructed handles
+		bool IsValid() const { return m_entry != nullptr; }
+		std::string_view view() const { return m_entry ? std::string_view {m_entry->data, m_entry->size} : std::string_view {}; }
+		Utf8StringView to_view() const;
+		// Same as utf8_hash(view()), but precomputed
+		size_t hash() const { return m_entry ? m_entry->hash : utf8_hash(std::string_view {}); }
+	  private:
+		InternedString(const detail::InternedEntry *entry) : m_entry {entry} {}
+		const detail::InternedEntry *m_entry = nullptr;
+	};
+
+	// Thread-safe, deduplicating string storage. Strings are stored in large arena blocks and are only
+	// released all at once by Clear() or when the pool is destroyed.
+	class DLLUUNIC StringPool {
+	  public:
+		struct Statistics {
+			// Number of unique strings
+			size_t stringCount = 0;
+			// Total size of the unique strings in bytes
+			size_t stringBytes = 0;
+			// Memory allocated for arena blocks in bytes
+			size_t arenaBytes = 0;
+			size_t arenaBlockCount = 0;
+			// Number of Intern calls, and how many of them returned an existing string
+			size_t internCount = 0;
+			size_t hitCount = 0;
+		};
+		// Strings larger than the block size get a dedicated block
+		explicit StringPool(size_t blockSize = 64 * 1024);
+		~StringPool();
+		StringPool(const StringPool &) = delete;
+		StringPool &operator=(const StringPool &) = delete;
+
+		// Ill-formed UTF-8 sequences are replaced with U+FFFD
+		InternedString Intern(std::string_view utf8);
+		InternedString Intern(const BaseUtf8String &str);
+		// Returns an invalid handle if the string has not been interned
+		InternedString Find(std::string_view utf8) const;
+		Statistics GetStatistics() const;
+		// Releases all strings at once. All handles from this pool become invalid.
+		void Clear();
+	  private:
+		// hash has to be utf8_hash(utf8)
+		InternedString InternValid(std::string_view utf8, size_t hash);
+		const detail::InternedEntry *Allocate(std::string_view utf8, size_t hash);
+		struct Block {
+			std::unique_ptr<char[]> data;
+			size_t size = 0;
+			size_t used = 0;
+		};
+		size_t m_blockSize;
+		std::vector<Block> m_blocks;
+		std::unordered_map<detail::HashedKey, const detail::InternedEntry *, detail::HashedKeyHash> m_entries;
+		size_t m_stringBytes = 0;
+		mutable std::shared_mutex m_mutex;
+		std::atomic<size_t> m_internCount = 0;
+		std::atomic<size_t> m_hitCount = 0;
+	};
+};
+
+template<>
+struct std::hash<pragma::string::InternedString> {
+	size_t operator()(const pragma::string::InternedString &str) const { return str.hash(); }
+};
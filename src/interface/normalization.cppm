@@ -0,0 +1,28 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "definitions.hpp"
+
+export module pragma.string.unicode:normalization;
+
+export import std.compat;
+import :utf8;
+
+export namespace pragma::string {
+	enum class NormalizationForm : uint8_t {
+		Nfc = 0,
+		Nfd,
+		Nfkc,
+		NfkcCasefold,
+		Count,
+	};
+	// Does not allocate
+	DLLUUNIC bool is_normalized(const BaseUtf8String &str, NormalizationForm form = NormalizationForm::Nfc);
+	DLLUUNIC Utf8String normalize(const BaseUtf8String &str, NormalizationForm form = NormalizationForm::Nfc);
+	// Normalizes str in place. Returns false (without allocating) if it was already normalized.
+	DLLUUNIC bool normalize_in_place(Utf8String &str, NormalizationForm form = NormalizationForm::Nfc);
+	// Compares the normalized forms of a and b. Only strings that aren't normalized already are copied.
+	DLLUUNIC bool normalized_equals(const BaseUtf8String &a, const BaseUtf8String &b, NormalizationForm form = NormalizationForm::Nfc);
+};
@@ -0,0 +1,27 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+module;
+
+#include "definitions.hpp"
+
+export module pragma.string.unicode:parallel;
+
+export import std.compat;
+
+export namespace pragma::string {
+	struct DLLUUNIC ParallelOptions {
+		// Number of worker threads, including the calling thread. 0 = std::thread::hardware_concurrency()
+		uint32_t threadCount = 0;
+		// Inputs are not split into chunks smaller than this (in bytes)
+		size_t minChunkSize = 1024 * 1024;
+		// Optional executor (e.g. a thread pool) which has to invoke task(i) for every i in [0, count) and
+		// may only return once all tasks have completed. If not set, std::threads are spawned for the duration of the call.
+		std::function<void(size_t count, const std::function<void(size_t)> &task)> executor;
+
+		uint32_t GetThreadCount() const;
+	};
+	// Invokes task(i) for every i in [0, count) and returns once all tasks have completed.
+	// If a task throws, the first exception is rethrown on the calling thread.
+	DLLUUNIC void run_parallel(size_t count, const std::function<void(size_t)> &task, const ParallelOptions &options = {});
+};
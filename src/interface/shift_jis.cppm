@@ -8,9 +8,65 @@ module;
 export module pragma.string.unicode:shift_jis;
 
 export import std.compat;
+import :parallel;
 
 export namespace pragma::string::unicode {
+	struct ShiftJisValidationOptions {
+		// Treat JIS X 0201 half-width katakana (0xA1-0xDF) as invalid
+		bool skipJis0201 = false;
+		// Accept line feeds and CR+LF line endings
+		bool includeCrlf = false;
+	};
+	struct ShiftJisValidationResult {
+		bool valid = true;
+		// Byte offset of the first invalid sequence, or std::string::npos if the data is valid
+		size_t errorOffset = std::string::npos;
+	};
+	// A built-in conversion table is used by default. This replaces it with a custom table loaded from the
+	// specified file. Only the first successful call has an effect, and it's safe to call from multiple threads.
 	DLLUUNIC void init_shift_jis(const std::string &dataFilePath);
-	DLLUUNIC uint32_t validate_shift_jis(const std::string &data);
-	DLLUUNIC std::string shift_jis_to_utf8(const std::string &input, bool validate = false);
+	// Returns the length (1 or 2) of the first character of data, or 0 if it is not a valid Shift_JIS character
+	DLLUUNIC uint32_t validate_shift_jis(const std::string &data, const ShiftJisValidationOptions &options = {});
+	// Validates the entire buffer
+	DLLUUNIC ShiftJisValidationResult validate_shift_jis_buffer(std::string_view data, const ShiftJisValidationOptions &options = {});
+	// If validate is true and the input is not valid Shift_JIS, it is returned unchanged
+	DLLUUNIC std::string shift_jis_to_utf8(const std::string &input, bool validate = false, const ShiftJisValidationOptions &validationOptions = {.includeCrlf = true});
+	enum class UnmappableCharPolicy : uint8_t {
+		Replace = 0,
+		Skip,
+		Throw,
+	};
+	struct ShiftJisEncodeOptions {
+		// How to handle characters that have no Shift_JIS representation (and ill-formed UTF-8)
+		UnmappableCharPolicy policy = UnmappableCharPolicy::Replace;
+		// Written in place of unmappable characters for UnmappableCharPolicy::Replace
+		char replacementChar = '?';
+	};
+	// Converts UTF-8 to Shift_JIS, using the reverse of the active conversion table (see init_shift_jis).
+	// With UnmappableCharPolicy::Throw, a std::runtime_error is thrown for the first unmappable character.
+	DLLUUNIC std::string utf8_to_shift_jis(std::string_view input, const ShiftJisEncodeOptions &options = {});
+
+	// Same as shift_jis_to_utf8, but splits large inputs into chunks which are converted concurrently.
+	// The output is identical to that of shift_jis_to_utf8.
+	DLLUUNIC std::string shift_jis_to_utf8_parallel(std::string_view input, const ParallelOptions &options = {});
+
+	// Converts Shift_JIS to UTF-8 incrementally, for input that arrives in chunks or doesn't fit into memory at once.
+	// Doesn't allocate, the output is written into caller-provided buffers.
+	class DLLUUNIC ShiftJisDecoder {
+	  public:
+		struct Result {
+			size_t bytesConsumed = 0;
+			size_t bytesWritten = 0;
+		};
+		// Converts as much of the input as fits into the output. Unconsumed input has to be passed again in the next call.
+		// A lead byte at the end of the input is consumed and combined with the first byte of the next chunk.
+		Result Decode(std::string_view input, std::span<char8_t> output);
+		// Has to be called after the last chunk. Writes U+FFFD if the input ended with an incomplete double-byte character,
+		// which requires 3 bytes of output space.
+		Result Finish(std::span<char8_t> output);
+		bool HasPendingLeadByte() const { return m_leadByte.has_value(); }
+		void Reset();
+	  private:
+		std::optional<uint8_t> m_leadByte {};
+	};
 };
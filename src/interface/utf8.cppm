@@ -9,102 +9,234 @@ export module pragma.string.unicode:utf8;
 
 export import std.compat;
 
+namespace pragma::string::detail {
+	class MappedFile;
+	struct Utf8StringAccess;
+};
+
 export namespace pragma::string {
 	class Utf8String;
+	class Utf8StringView;
 	class BaseUtf8String;
 	using Char8 = char;
 	using Char16 = char16_t;
 	using Char32 = int32_t;
+	// Bidirectional iterator over the code points of a string. It only refers to the UTF-8 data of the
+	// string, so copying it is free and it is invalidated by any modification of the string.
 	class DLLUUNIC UnicodeStringIterator {
 	  public:
 		friend Utf8String;
 		using value_type = Char32;
+		using difference_type = std::ptrdiff_t;
+		using reference = Char32;
+		using iterator_category = std::bidirectional_iterator_tag;
+		using iterator_concept = std::bidirectional_iterator_tag;
+		UnicodeStringIterator() = default;
 		UnicodeStringIterator(const BaseUtf8String &str);
-		UnicodeStringIterator(const UnicodeStringIterator &it);
-		~UnicodeStringIterator();
-
-		bool operator<(const UnicodeStringIterator &other) const;
-		bool operator>(const UnicodeStringIterator &other) const;
-		bool operator==(const UnicodeStringIterator &other) const;
-		bool operator!=(const UnicodeStringIterator &other) const;
-
-		Char32 operator*() const;
-		UnicodeStringIterator &operator++();
-		UnicodeStringIterator &operator--();
-		UnicodeStringIterator operator+(int32_t idx) const;
-		UnicodeStringIterator &operator+=(int32_t idx);
-		UnicodeStringIterator &operator=(const UnicodeStringIterator &other);
+
+		bool operator<(const UnicodeStringIterator &other) const { return m_offset < other.m_offset; }
+		bool operator>(const UnicodeStringIterator &other) const { return m_offset > other.m_offset; }
+		bool operator==(const UnicodeStringIterator &other) const { return m_offset == other.m_offset; }
+		bool operator!=(const UnicodeStringIterator &other) const { return m_offset != other.m_offset; }
+
+		Char32 operator*() const
+		{
+			auto *p = reinterpret_cast<const uint8_t *>(m_data + m_offset);
+			if(p[0] < 0x80)
+				return p[0];
+			if(p[0] < 0xE0)
+				return ((p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+			if(p[0] < 0xF0)
+				return ((p[0] & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+			return ((p[0] & 0x07) << 18) | ((p[1] & 0x3F) << 12) | ((p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+		}
+		UnicodeStringIterator &operator++()
+		{
+			auto lead = static_cast<uint8_t>(m_data[m_offset]);
+			m_offset += (lead < 0x80) ? 1 : (lead < 0xE0) ? 2 : (lead < 0xF0) ? 3 : 4;
+			return *this;
+		}
+		UnicodeStringIterator &operator--()
+		{
+			if(m_offset == 0)
+				return *this;
+			do
+				--m_offset;
+			while(m_offset > 0 && (static_cast<uint8_t>(m_data[m_offset]) & 0xC0) == 0x80);
+			return *this;
+		}
+		UnicodeStringIterator operator++(int)
+		{
+			auto it = *this;
+			operator++();
+			return it;
+		}
+		UnicodeStringIterator operator--(int)
+		{
+			auto it = *this;
+			operator--();
+			return it;
+		}
+		// Moves the iterator by idx code points, which takes O(|idx|)
+		UnicodeStringIterator operator+(int32_t idx) const
+		{
+			auto it = *this;
+			it += idx;
+			return it;
+		}
+		UnicodeStringIterator operator-(int32_t idx) const
+		{
+			auto it = *this;
+			it -= idx;
+			return it;
+		}
+		UnicodeStringIterator &operator+=(int32_t idx)
+		{
+			for(; idx > 0; --idx)
+				operator++();
+			for(; idx < 0; ++idx)
+				operator--();
+			return *this;
+		}
+		UnicodeStringIterator &operator-=(int32_t idx) { return operator+=(-idx); }
 	  private:
 		friend BaseUtf8String;
-		UnicodeStringIterator();
-		std::unique_ptr<icu_78::StringCharacterIterator> iterator;
-		bool done;
+		UnicodeStringIterator(const Char8 *data, size_t offset) : m_data {data}, m_offset {offset} {}
+		const Char8 *m_data = nullptr;
+		// Byte offset into the UTF-8 data
+		size_t m_offset = 0;
 	};
+	static_assert(std::bidirectional_iterator<UnicodeStringIterator>);
 
+	enum class BreakType : uint8_t {
+		Grapheme = 0,
+		Word,
+		Line,
+		Count,
+	};
+
+	// All positions, indices and counts are in code points.
 	class DLLUUNIC BaseUtf8String {
 	  public:
 		static constexpr inline size_t npos = std::string::npos;
 		friend UnicodeStringIterator;
 		virtual ~BaseUtf8String();
 		std::string cpp_str() const;
+		// Returns a view of the underlying UTF-8 data without copying or transcoding it
+		virtual std::string_view view() const = 0;
 		size_t find(Char8 c, size_t startPos = 0) const;
 		size_t find(Char16 c, size_t startPos = 0) const;
 		size_t find(Char32 c, size_t startPos = 0) const;
 		size_t find(const char *str, size_t startPos = 0) const;
 		size_t find(const std::string &str, size_t startPos = 0) const;
 		size_t find(const BaseUtf8String &str, size_t startPos = 0) const;
+		// Returns the last occurrence that starts at or before startPos
+		size_t rfind(Char32 c, size_t startPos = npos) const;
+		size_t rfind(const char *str, size_t startPos = npos) const;
+		size_t rfind(const std::string &str, size_t startPos = npos) const;
+		size_t rfind(const BaseUtf8String &str, size_t startPos = npos) const;
+		// Returns the first code point at or after startPos that is contained in chars
+		size_t find_first_of(const char *chars, size_t startPos = 0) const;
+		size_t find_first_of(const std::string &chars, size_t startPos = 0) const;
+		size_t find_first_of(const BaseUtf8String &chars, size_t startPos = 0) const;
+		// Returns the positions of all non-overlapping occurrences at or after startPos
+		std::vector<size_t> find_all(const char *str, size_t startPos = 0) const;
+		std::vector<size_t> find_all(const std::string &str, size_t startPos = 0) const;
+		std::vector<size_t> find_all(const BaseUtf8String &str, size_t startPos = 0) const;
 		UnicodeStringIterator begin() const;
 		UnicodeStringIterator end() const;
+		// Build and cache the UTF-16 representation. Unlike the const member functions (which only cache into
+		// atomics), these are not thread-safe and must not be called concurrently with any other access to the string.
 		const char16_t *data();
 		const char16_t *c_str();
 		size_t length() const;
 		size_t size() const;
-		bool empty() const { return length() == 0; }
+		bool empty() const { return view().empty(); }
 		Char32 at(size_t idx) const;
 		Char32 front() const;
 		Char32 back() const;
 
-		void toUpper();
-		void toLower();
+		// Text segmentation according to UAX #29 (graphemes, words) and UAX #14 (line break opportunities).
+		// Returns the first boundary after pos, or length() if there is none
+		size_t next_boundary(size_t pos, BreakType type = BreakType::Grapheme) const;
+		// Returns the last boundary before pos, or 0 if there is none
+		size_t previous_boundary(size_t pos, BreakType type = BreakType::Grapheme) const;
+		// Returns all boundaries in ascending order, including 0 and length()
+		std::vector<size_t> boundaries(BreakType type) const;
+		// Returns the segments between consecutive boundaries as views into this string
+		std::vector<Utf8StringView> segments(BreakType type) const;
 
 		bool operator==(const BaseUtf8String &other) const;
 		bool operator!=(const BaseUtf8String &other) const;
 		bool operator==(const std::string &other) const;
 		bool operator!=(const std::string &other) const;
 
-		bool operator<(const BaseUtf8String &other) const;
-		bool operator>(const BaseUtf8String &other) const;
+		// Lexicographical by code point (which is the same as by UTF-8 code unit)
+		std::strong_ordering operator<=>(const BaseUtf8String &other) const;
+		std::strong_ordering operator<=>(const std::string &other) const;
 
 		operator std::string() const;
 	  protected:
 		BaseUtf8String();
-		BaseUtf8String(std::unique_ptr<icu_78::UnicodeString> &&str);
-		icu_78::UnicodeString &GetIcuString();
-		const icu_78::UnicodeString &GetIcuString() const;
-		std::unique_ptr<icu_78::UnicodeString> m_string;
+		BaseUtf8String(BaseUtf8String &&other) noexcept;
+		BaseUtf8String &operator=(BaseUtf8String &&other) noexcept;
+		// Not const, since it lazily builds m_utf16 without synchronization
+		const icu_78::UnicodeString &GetIcuString();
+		void InvalidateCache();
+		// Must be called after the UTF-8 data has been copied from other
+		void CopyLength(const BaseUtf8String &other);
+		size_t Find(std::string_view utf8, size_t startPos) const;
+		size_t RFind(std::string_view utf8, size_t startPos) const;
+		size_t FindFirstOf(std::string_view utf8Chars, size_t startPos) const;
+		std::vector<size_t> FindAll(std::string_view utf8, size_t startPos) const;
+		// Translates a code point index into a byte offset into view() (clamped to the size of the string)
+		size_t GetByteOffset(size_t idx) const;
+		// Translates a byte offset into view() into a code point index
+		size_t GetCodePointIndex(size_t offset) const;
+		// Returns the byte range [first, second) of count code points starting at code point start
+		std::pair<size_t, size_t> GetByteRange(size_t start, size_t count) const;
+		const std::vector<uint32_t> *GetBreadcrumbs() const;
+		// UTF-16 representation, only built on demand by data() / c_str(). Not synchronized, see data().
+		std::unique_ptr<icu_78::UnicodeString> m_utf16;
+		// Number of code points, or npos if it hasn't been counted since the last modification
+		mutable std::atomic<size_t> m_length = npos;
+		// Byte offset of every BREADCRUMB_INTERVAL-th code point. Only built for long non-ASCII strings,
+		// when a code point index has to be translated.
+		mutable std::atomic<std::vector<uint32_t> *> m_breadcrumbs = nullptr;
 	};
 
-	class Utf8StringView;
 	class Utf8StringArg;
+	class Utf8StringBuilder;
+	class InternedString;
+	class Utf8StringTable;
 	class DLLUUNIC Utf8String : public BaseUtf8String {
 	  public:
 		friend Utf8StringView;
+		friend Utf8StringBuilder;
+		friend detail::MappedFile;
+		friend detail::Utf8StringAccess;
 		Utf8String();
 		Utf8String(Char16 c);
 		Utf8String(Char32 c);
 		Utf8String(const Utf8String &str);
+		Utf8String(Utf8String &&str) noexcept;
 		Utf8String(const Utf8StringView &str);
 		Utf8String(const std::string &str);
+		// Takes over the buffer of str if it already contains well-formed UTF-8
+		Utf8String(std::string &&str);
 		Utf8String(const char *str);
 		Utf8String(const char *str, size_t count);
 		Utf8String(const char16_t *str);
 		Utf8String(const char16_t *str, size_t count);
 		Utf8String(const int32_t *str, size_t count);
 		Utf8String &operator=(const Utf8String &str);
+		Utf8String &operator=(Utf8String &&str) noexcept;
 		Utf8String &operator=(const Utf8StringView &str);
 		Utf8String &operator=(const std::string &str);
+		Utf8String &operator=(std::string &&str);
 		Utf8String &operator=(const char *str);
 		Utf8String &operator=(const char16_t *str);
+		std::string_view view() const override { return m_utf8; }
 
 		Utf8String operator+(const Utf8String &str) const;
 		Utf8String operator+(const Utf8StringView &str) const;
@@ -130,25 +262,52 @@ export namespace pragma::string {
 		void insert(const UnicodeStringIterator &it, const Utf8StringArg &str);
 		Utf8String substr(size_t start, size_t count = std::numeric_limits<size_t>::max()) const;
 		void clear();
+		// Capacity of the UTF-8 buffer in bytes
+		void reserve(size_t bytes) { m_utf8.reserve(bytes); }
+		size_t capacity() const { return m_utf8.capacity(); }
+		void shrink_to_fit() { m_utf8.shrink_to_fit(); }
+
+		void toUpper();
+		void toLower();
+	  private:
+		// Replaces the byte range [offset, endOffset) with utf8, which has to be well-formed
+		void ReplaceBytes(size_t offset, size_t endOffset, std::string_view utf8);
+		// Returns a copy with room for another extraBytes bytes
+		Utf8String CopyWithCapacity(size_t extraBytes) const;
+		// Always contains well-formed UTF-8
+		std::string m_utf8;
 	};
 
+	// Non-owning view of well-formed UTF-8 data, e.g. (part of) a Utf8String. The viewed data
+	// has to outlive the view, and modifying a Utf8String invalidates all views of it.
 	class DLLUUNIC Utf8StringView : public BaseUtf8String {
 	  public:
 		friend Utf8String;
+		friend Utf8StringArg;
+		friend InternedString;
+		friend Utf8StringTable;
+		friend BaseUtf8String;
 		Utf8StringView();
 		Utf8StringView(const Utf8String &str);
 		Utf8StringView(const Utf8StringView &str);
+		Utf8StringView(Utf8StringView &&str) noexcept;
+		// Throws a std::runtime_error if utf8 is not well-formed UTF-8
+		explicit Utf8StringView(std::string_view utf8);
 		~Utf8StringView();
 		Utf8StringView &operator=(const Utf8String &str);
 		Utf8StringView &operator=(const Utf8StringView &str);
+		Utf8StringView &operator=(Utf8StringView &&str) noexcept;
+		std::string_view view() const override { return {m_data, m_size}; }
+		// Does not copy or allocate, the result refers to the same data as this view
 		Utf8StringView substr(size_t start, size_t count = std::numeric_limits<size_t>::max()) const;
 		Utf8String to_str() const;
 	  private:
-		const icu_78::UnicodeString *m_underlyingString = nullptr;
-		size_t m_start = 0;
-		size_t m_length = std::numeric_limits<size_t>::max();
+		const Char8 *m_data = nullptr;
+		size_t m_size = 0;
 	};
 
+	// Borrows Utf8String and Utf8StringView arguments, as well as well-formed UTF-8 strings.
+	// Only ill-formed UTF-8 input is copied (and sanitized).
 	class DLLUUNIC Utf8StringArg {
 	  public:
 		Utf8StringArg(const char *text);
@@ -159,9 +318,132 @@ export namespace pragma::string {
 		const Utf8StringView &operator*() const;
 		const Utf8StringView *operator->() const;
 	  private:
+		Utf8StringArg(std::string_view text);
 		std::unique_ptr<Utf8String> m_cpy;
 		Utf8StringView m_view;
 	};
+
+	// Builds a Utf8String by appending to a single growing buffer, which is handed over to the string by Finish().
+	class DLLUUNIC Utf8StringBuilder {
+	  public:
+		Utf8StringBuilder() = default;
+		// Capacity in bytes
+		explicit Utf8StringBuilder(size_t capacity);
+		// Ill-formed UTF-8 / unpaired surrogates / invalid code points are replaced with U+FFFD
+		Utf8StringBuilder &Append(std::string_view utf8);
+		Utf8StringBuilder &Append(std::u16string_view utf16);
+		Utf8StringBuilder &Append(const BaseUtf8String &str);
+		Utf8StringBuilder &AppendCodePoint(Char32 c);
+		template<typename T>
+		    requires(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>)
+		Utf8StringBuilder &AppendNumber(T value)
+		{
+			char buf[64];
+			auto [end, ec] = std::to_chars(buf, buf + std::size(buf), value);
+			m_buffer.append(buf, end);
+			return *this;
+		}
+		// Output iterator for std::format_to and similar. Anything written through it is validated by Finish().
+		std::back_insert_iterator<std::string> GetBackInserter();
+
+		void Reserve(size_t bytes) { m_buffer.reserve(bytes); }
+		size_t GetSize() const { return m_buffer.size(); }
+		size_t GetCapacity() const { return m_buffer.capacity(); }
+		std::string_view GetView() const { return m_buffer; }
+		void Clear();
+		// Moves the buffer into the returned string and resets the builder
+		Utf8String Finish();
+	  private:
+		std::string m_buffer;
+		bool m_requiresValidation = false;
+	};
+
+	// Case-insensitive comparison by simple case folding (e.g. "ß" and "ss" are not considered equal). Does not allocate.
+	DLLUUNIC int icompare(const BaseUtf8String &a, const BaseUtf8String &b);
+	DLLUUNIC bool iequals(const BaseUtf8String &a, const BaseUtf8String &b);
+	// Hash of the case-folded string, consistent with iequals
+	DLLUUNIC size_t ihash(const BaseUtf8String &str);
+	struct CaseInsensitiveHash {
+		size_t operator()(const BaseUtf8String &str) const { return ihash(str); }
+	};
+	struct CaseInsensitiveEqual {
+		bool operator()(const BaseUtf8String &a, const BaseUtf8String &b) const { return iequals(a, b); }
+	};
+
+	// Hash of UTF-8 data. The UTF-16 overload returns the hash of the equivalent UTF-8 data without transcoding it into a buffer.
+	DLLUUNIC size_t utf8_hash(std::string_view utf8);
+	DLLUUNIC size_t utf8_hash(std::u16string_view utf16);
+	// Unpaired surrogates in utf16 are treated as U+FFFD, same as when converting to a Utf8String
+	DLLUUNIC bool utf8_equals(std::string_view utf8, std::u16string_view utf16);
+
+	namespace detail {
+		template<typename T>
+		concept Utf8Key = std::is_convertible_v<const T &, std::string_view> && !std::is_base_of_v<BaseUtf8String, T>;
+		template<typename T>
+		concept Utf16Key = std::is_convertible_v<const T &, std::u16string_view> && !std::is_base_of_v<BaseUtf8String, T>;
+	};
+	// Transparent hash and equality, e.g. for a std::unordered_map<Utf8String, T, Utf8StringHash, Utf8StringEqual>
+	// that can be looked up with UTF-8 or UTF-16 strings without constructing a Utf8String
+	struct Utf8StringHash {
+		using is_transparent = void;
+		size_t operator()(const BaseUtf8String &str) const { return utf8_hash(str.view()); }
+		template<detail::Utf8Key T>
+		size_t operator()(const T &str) const
+		{
+			return utf8_hash(std::string_view {str});
+		}
+		template<detail::Utf16Key T>
+		size_t operator()(const T &str) const
+		{
+			return utf8_hash(std::u16string_view {str});
+		}
+	};
+	struct Utf8StringEqual {
+		using is_transparent = void;
+		bool operator()(const BaseUtf8String &a, const BaseUtf8String &b) const { return a.view() == b.view(); }
+		template<detail::Utf8Key T>
+		bool operator()(const BaseUtf8String &a, const T &b) const
+		{
+			return a.view() == std::string_view {b};
+		}
+		template<detail::Utf8Key T>
+		bool operator()(const T &a, const BaseUtf8String &b) const
+		{
+			return std::string_view {a} == b.view();
+		}
+		template<detail::Utf16Key T>
+		bool operator()(const BaseUtf8String &a, const T &b) const
+		{
+			return utf8_equals(a.view(), std::u16string_view {b});
+		}
+		template<detail::Utf16Key T>
+		bool operator()(const T &a, const BaseUtf8String &b) const
+		{
+			return utf8_equals(b.view(), std::u16string_view {a});
+		}
+	};
+
 	DLLUUNIC std::ostream &operator<<(std::ostream &out, const Utf8String &str);
 	DLLUUNIC std::ostream &operator<<(std::ostream &out, const Utf8StringView &str);
 };
+
+template<>
+struct std::hash<pragma::string::Utf8String> {
+	size_t operator()(const pragma::string::Utf8String &str) const { return pragma::string::utf8_hash(str.view()); }
+};
+template<>
+struct std::hash<pragma::string::Utf8StringView> {
+	size_t operator()(const pragma::string::Utf8StringView &str) const { return pragma::string::utf8_hash(str.view()); }
+};
+
+namespace pragma::string::detail {
+	struct Utf8StringAccess {
+		// Takes over utf8 without validating it, for decoders whose output is well-formed by construction
+		static Utf8String AdoptWellFormed(std::string &&utf8)
+		{
+			Utf8String str {};
+			str.m_utf8 = std::move(utf8);
+			return str;
+		}
+	};
+};
@@ -0,0 +1,113 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef __UTIL_UNICODE_SEARCH_HPP__
+#define __UTIL_UNICODE_SEARCH_HPP__
+
+#include "simd.hpp"
+#include <array>
+#include <cstring>
+#include <string_view>
+
+// Substring search on raw code units. For well-formed UTF-8 every match automatically starts
+// and ends on a code point boundary, so no decoding is required.
+namespace pragma::string::detail {
+	// Needles up to this size use the SIMD first/last byte filter, longer ones use Horspool
+	constexpr size_t SEARCH_HORSPOOL_MIN_NEEDLE_SIZE = 32;
+
+	inline size_t find_bytes_scalar(const char *haystack, size_t size, const char *needle, size_t needleSize, size_t from)
+	{
+		auto pos = std::string_view {haystack, size}.find(std::string_view {needle, needleSize}, from);
+		return (pos != std::string_view::npos) ? pos : size;
+	}
+
+	// Compares the first and last byte of the needle against 16/32 candidate positions at once and
+	// only verifies the candidates where both match. Requires needleSize >= 2.
+#ifdef UUNIC_SIMD_X86
+	inline size_t find_bytes_sse2(const char *haystack, size_t size, const char *needle, size_t needleSize, size_t from)
+	{
+		auto first = _mm_set1_epi8(needle[0]);
+		auto last = _mm_set1_epi8(needle[needleSize - 1]);
+		auto pos = from;
+		for(; pos + needleSize - 1 + sizeof(__m128i) <= size; pos += sizeof(__m128i)) {
+			auto blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + pos));
+			auto blockLast = _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + pos + needleSize - 1));
+			auto mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(last, blockLast))));
+			for(; mask != 0; mask &= mask - 1) {
+				auto candidate = pos + count_trailing_zeros(mask);
+				if(std::memcmp(haystack + candidate + 1, needle + 1, needleSize - 2) == 0)
+					return candidate;
+			}
+		}
+		return find_bytes_scalar(haystack, size, needle, needleSize, pos);
+	}
+
+	UUNIC_TARGET_AVX2 inline size_t find_bytes_avx2(const char *haystack, size_t size, const char *needle, size_t needleSize, size_t from)
+	{
+		auto first = _mm256_set1_epi8(needle[0]);
+		auto last = _mm256_set1_epi8(needle[needleSize - 1]);
+		auto pos = from;
+		for(; pos + needleSize - 1 + sizeof(__m256i) <= size; pos += sizeof(__m256i)) {
+			auto blockFirst = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(haystack + pos));
+			auto blockLast = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(haystack + pos + needleSize - 1));
+			auto mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, blockFirst), _mm256_cmpeq_epi8(last, blockLast))));
+			for(; mask != 0; mask &= mask - 1) {
+				auto candidate = pos + count_trailing_zeros(mask);
+				if(std::memcmp(haystack + candidate + 1, needle + 1, needleSize - 2) == 0)
+					return candidate;
+			}
+		}
+		return find_bytes_scalar(haystack, size, needle, needleSize, pos);
+	}
+#endif
+
+	inline size_t find_bytes_horspool(const char *haystack, size_t size, const char *needle, size_t needleSize, size_t from)
+	{
+		std::array<size_t, 256> shift;
+		shift.fill(needleSize);
+		for(size_t i = 0; i < needleSize - 1; ++i)
+			shift[static_cast<uint8_t>(needle[i])] = needleSize - 1 - i;
+		auto last = needle[needleSize - 1];
+		for(auto pos = from; pos + needleSize <= size;) {
+			auto c = haystack[pos + needleSize - 1];
+			if(c == last && std::memcmp(haystack + pos, needle, needleSize - 1) == 0)
+				return pos;
+			pos += shift[static_cast<uint8_t>(c)];
+		}
+		return size;
+	}
+
+	using FindBytesFunc = size_t (*)(const char *, size_t, const char *, size_t, size_t);
+	inline FindBytesFunc get_find_bytes_func()
+	{
+#ifdef UUNIC_SIMD_X86
+		if(has_avx2())
+			return find_bytes_avx2;
+		return find_bytes_sse2;
+#else
+		return find_bytes_scalar;
+#endif
+	}
+
+	// Returns the offset of the first occurrence of needle in haystack at or after from, or std::string_view::npos
+	inline size_t find_bytes(std::string_view haystack, std::string_view needle, size_t from = 0)
+	{
+		static const FindBytesFunc findShort = get_find_bytes_func();
+		if(from > haystack.size() || needle.size() > haystack.size() - from)
+			return std::string_view::npos;
+		if(needle.empty())
+			return from;
+		size_t pos;
+		if(needle.size() == 1) {
+			auto *p = static_cast<const char *>(std::memchr(haystack.data() + from, needle[0], haystack.size() - from));
+			return p ? static_cast<size_t>(p - haystack.data()) : std::string_view::npos;
+		}
+		if(needle.size() < SEARCH_HORSPOOL_MIN_NEEDLE_SIZE)
+			pos = findShort(haystack.data(), haystack.size(), needle.data(), needle.size(), from);
+		else
+			pos = find_bytes_horspool(haystack.data(), haystack.size(), needle.data(), needle.size(), from);
+		return (pos < haystack.size()) ? pos : std::string_view::npos;
+	}
+};
+
+#endif
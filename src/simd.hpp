@@ -0,0 +1,59 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef __UTIL_UNICODE_SIMD_HPP__
+#define __UTIL_UNICODE_SIMD_HPP__
+
+// SSE2 is part of the x86-64 baseline and can be used unconditionally, AVX2 code paths
+// have to be marked with UUNIC_TARGET_AVX2 and may only be called if has_avx2() returns true.
+#if defined(__x86_64__) || defined(_M_X64)
+#define UUNIC_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define UUNIC_TARGET_AVX2
+#else
+#define UUNIC_TARGET_AVX2 __attribute__((target("avx2,bmi")))
+#endif
+#endif
+
+namespace pragma::string::detail {
+#ifdef UUNIC_SIMD_X86
+	inline bool has_avx2()
+	{
+		static const bool supported = []() {
+#ifdef _MSC_VER
+			int info[4];
+			__cpuid(info, 0);
+			if(info[0] < 7)
+				return false;
+			__cpuid(info, 1);
+			constexpr int osxsave = 1 << 27;
+			constexpr int avx = 1 << 28;
+			if((info[2] & osxsave) == 0 || (info[2] & avx) == 0 || (_xgetbv(0) & 6) != 6)
+				return false;
+			__cpuidex(info, 7, 0);
+			constexpr int avx2 = 1 << 5;
+			return (info[1] & avx2) != 0;
+#else
+			return __builtin_cpu_supports("avx2") != 0;
+#endif
+		}();
+		return supported;
+	}
+	inline unsigned int count_trailing_zeros(unsigned int mask)
+	{
+#ifdef _MSC_VER
+		unsigned long idx;
+		_BitScanForward(&idx, mask);
+		return idx;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+#else
+	inline bool has_avx2() { return false; }
+#endif
+};
+
+#endif
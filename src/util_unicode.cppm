@@ -4,3 +4,10 @@
 export module pragma.string.unicode;
 export import :utf8;
 export import :shift_jis;
+export import :parallel;
+export import :intern;
+export import :normalization;
+export import :batch;
+export import :instrumentation;
+export import :detection;
+export import :file;
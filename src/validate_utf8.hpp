@@ -0,0 +1,206 @@
+// SPDX-FileCopyrightText: (c) 2024 Silverlan <opensource@pragma-engine.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef __UTIL_UNICODE_VALIDATE_UTF8_HPP__
+#define __UTIL_UNICODE_VALIDATE_UTF8_HPP__
+
+#include "simd.hpp"
+#include <cstdint>
+#include <cstring>
+
+// UTF-8 validation following Unicode Table 3-7 (no overlongs, surrogates or code points above U+10FFFF).
+// All variants return the offset of the first ill-formed sequence, or size if the data is well-formed.
+namespace pragma::string::detail {
+	// Returns the length of the well-formed sequence that starts with the non-ASCII byte at pos, or 0 if it is ill-formed
+	inline size_t get_utf8_sequence_length(const uint8_t *p, size_t size, size_t pos)
+	{
+		auto isCont = [&](size_t i, uint8_t lo = 0x80, uint8_t hi = 0xBF) { return i < size && p[i] >= lo && p[i] <= hi; };
+		auto c = p[pos];
+		if(c >= 0xC2 && c <= 0xDF)
+			return isCont(pos + 1) ? 2 : 0;
+		if(c >= 0xE0 && c <= 0xEF) {
+			auto lo = (c == 0xE0) ? 0xA0 : 0x80;
+			auto hi = (c == 0xED) ? 0x9F : 0xBF;
+			return (isCont(pos + 1, lo, hi) && isCont(pos + 2)) ? 3 : 0;
+		}
+		if(c >= 0xF0 && c <= 0xF4) {
+			auto lo = (c == 0xF0) ? 0x90 : 0x80;
+			auto hi = (c == 0xF4) ? 0x8F : 0xBF;
+			return (isCont(pos + 1, lo, hi) && isCont(pos + 2) && isCont(pos + 3)) ? 4 : 0;
+		}
+		return 0;
+	}
+	inline size_t find_invalid_utf8_scalar(const char *data, size_t size, size_t pos = 0)
+	{
+		auto *p = reinterpret_cast<const uint8_t *>(data);
+		while(pos < size) {
+			if(p[pos] < 0x80) {
+				// Skip ASCII 8 bytes at a time
+				uint64_t block;
+				if(pos + sizeof(block) <= size) {
+					std::memcpy(&block, p + pos, sizeof(block));
+					if((block & 0x8080808080808080ull) == 0) {
+						pos += sizeof(block);
+						continue;
+					}
+				}
+				++pos;
+				continue;
+			}
+			auto len = get_utf8_sequence_length(p, size, pos);
+			if(len == 0)
+				return pos;
+			pos += len;
+		}
+		return size;
+	}
+
+	// Moves pos back over up to three continuation bytes, to the start of the code point that contains it.
+	// Data that is split at the result can be validated in parts.
+	inline size_t find_code_point_start(const char *data, size_t pos)
+	{
+		for(size_t i = 0; i < 3 && pos > 0 && (static_cast<uint8_t>(data[pos]) & 0xC0) == 0x80; ++i)
+			--pos;
+		return pos;
+	}
+
+	// If the vectorized validator finds an error in the block at pos, the ill-formed sequence may have started up to
+	// three bytes earlier. The scalar validator resumes at the start of the code point that contains pos - 3.
+	inline size_t find_error_search_start(const char *data, size_t pos) { return (pos < 3) ? 0 : find_code_point_start(data, pos - 3); }
+
+#ifdef UUNIC_SIMD_X86
+	// Same as find_invalid_utf8_scalar, but skips ASCII up to 16 bytes at a time
+	inline size_t find_invalid_utf8_sse2(const char *data, size_t size)
+	{
+		auto *p = reinterpret_cast<const uint8_t *>(data);
+		size_t pos = 0;
+		while(pos < size) {
+			if(p[pos] < 0x80) {
+				if(pos + sizeof(__m128i) <= size) {
+					// Skips to the first non-ASCII byte in the block, or past the whole block
+					auto mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + pos))));
+					pos += (mask != 0) ? count_trailing_zeros(mask) : sizeof(__m128i);
+					continue;
+				}
+				++pos;
+				continue;
+			}
+			auto len = get_utf8_sequence_length(p, size, pos);
+			if(len == 0)
+				return pos;
+			pos += len;
+		}
+		return size;
+	}
+
+	// Lookup-table validation of 32 bytes at a time (Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction
+	// Per Byte"). Every byte is classified by the high nibble of the previous byte, the low nibble of the previous byte
+	// and the high nibble of the byte itself, and an error remains if all three lookups agree on it.
+	namespace utf8_lookup {
+		constexpr uint8_t TOO_SHORT = 1 << 0;
+		constexpr uint8_t TOO_LONG = 1 << 1;
+		constexpr uint8_t OVERLONG_3 = 1 << 2;
+		constexpr uint8_t TOO_LARGE = 1 << 3;
+		constexpr uint8_t SURROGATE = 1 << 4;
+		constexpr uint8_t OVERLONG_2 = 1 << 5;
+		constexpr uint8_t TOO_LARGE_1000 = 1 << 6;
+		constexpr uint8_t OVERLONG_4 = 1 << 6;
+		constexpr uint8_t TWO_CONTS = 1 << 7;
+		constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+	};
+
+	UUNIC_TARGET_AVX2 inline __m256i lookup_16(__m256i nibbles, const uint8_t (&table)[16])
+	{
+		auto t = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table));
+		return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(t), nibbles);
+	}
+	// Bytes of input shifted by n positions, with the last bytes of prevInput shifted in
+	template<int N>
+	UUNIC_TARGET_AVX2 inline __m256i prev_bytes(__m256i input, __m256i prevInput)
+	{
+		return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prevInput, input, 0x21), 16 - N);
+	}
+	UUNIC_TARGET_AVX2 inline __m256i check_utf8_block(__m256i input, __m256i prevInput)
+	{
+		using namespace utf8_lookup;
+		static constexpr uint8_t byte1High[16] = {TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, TOO_SHORT | OVERLONG_2, TOO_SHORT,
+		  TOO_SHORT | OVERLONG_3 | SURROGATE, TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4};
+		static constexpr uint8_t byte1Low[16] = {CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY, CARRY, CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+		  CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+		  CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000};
+		static constexpr uint8_t byte2High[16] = {TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+		  TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE, TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT};
+
+		auto lowNibbleMask = _mm256_set1_epi8(0x0F);
+		auto prev1 = prev_bytes<1>(input, prevInput);
+		auto specialCases = _mm256_and_si256(_mm256_and_si256(lookup_16(_mm256_and_si256(_mm256_srli_epi16(prev1, 4), lowNibbleMask), byte1High), lookup_16(_mm256_and_si256(prev1, lowNibbleMask), byte1Low)),
+		  lookup_16(_mm256_and_si256(_mm256_srli_epi16(input, 4), lowNibbleMask), byte2High));
+
+		// The third and fourth bytes of 3- and 4-byte sequences have to be continuations (which the lookup above
+		// classifies as TWO_CONTS), and only those
+		auto isThirdByte = _mm256_subs_epu8(prev_bytes<2>(input, prevInput), _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+		auto isFourthByte = _mm256_subs_epu8(prev_bytes<3>(input, prevInput), _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+		auto must23 = _mm256_and_si256(_mm256_or_si256(isThirdByte, isFourthByte), _mm256_set1_epi8(static_cast<char>(0x80)));
+		return _mm256_xor_si256(must23, specialCases);
+	}
+	// Non-zero if the block ends with an incomplete sequence
+	UUNIC_TARGET_AVX2 inline __m256i check_utf8_incomplete(__m256i input)
+	{
+		auto maxValue = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1),
+		  static_cast<char>(0xC0 - 1));
+		return _mm256_subs_epu8(input, maxValue);
+	}
+	// Returns false if an error was found in input, or in a sequence that started in an earlier block
+	UUNIC_TARGET_AVX2 inline bool check_utf8_next_block(__m256i input, __m256i &prevInput, __m256i &prevIncomplete)
+	{
+		__m256i error;
+		if(_mm256_movemask_epi8(input) == 0)
+			error = prevIncomplete;
+		else {
+			error = check_utf8_block(input, prevInput);
+			prevIncomplete = check_utf8_incomplete(input);
+		}
+		prevInput = input;
+		return _mm256_testz_si256(error, error);
+	}
+	UUNIC_TARGET_AVX2 inline size_t find_invalid_utf8_avx2(const char *data, size_t size)
+	{
+		auto prevInput = _mm256_setzero_si256();
+		auto prevIncomplete = _mm256_setzero_si256();
+		size_t pos = 0;
+		for(; pos + sizeof(__m256i) <= size; pos += sizeof(__m256i)) {
+			if(!check_utf8_next_block(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos)), prevInput, prevIncomplete))
+				return find_invalid_utf8_scalar(data, size, find_error_search_start(data, pos));
+		}
+		// The remaining bytes are padded with zeroes, which also catches sequences that are cut off by the end of the data
+		if(pos < size) {
+			alignas(32) char block[sizeof(__m256i)] {};
+			std::memcpy(block, data + pos, size - pos);
+			if(!check_utf8_next_block(_mm256_load_si256(reinterpret_cast<const __m256i *>(block)), prevInput, prevIncomplete))
+				return find_invalid_utf8_scalar(data, size, find_error_search_start(data, pos));
+		}
+		else if(!_mm256_testz_si256(prevIncomplete, prevIncomplete))
+			return find_invalid_utf8_scalar(data, size, find_error_search_start(data, pos));
+		return size;
+	}
+#endif
+
+	using FindInvalidUtf8Func = size_t (*)(const char *, size_t);
+	inline FindInvalidUtf8Func get_find_invalid_utf8_func()
+	{
+#ifdef UUNIC_SIMD_X86
+		if(has_avx2())
+			return find_invalid_utf8_avx2;
+		return find_invalid_utf8_sse2;
+#else
+		return [](const char *data, size_t size) { return find_invalid_utf8_scalar(data, size); };
+#endif
+	}
+	inline size_t find_invalid_utf8(const char *data, size_t size)
+	{
+		static const FindInvalidUtf8Func findInvalid = get_find_invalid_utf8_func();
+		return findInvalid(data, size);
+	}
+};
+
+#endif